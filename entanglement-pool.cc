@@ -0,0 +1,269 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <math.h>
+#include <algorithm>
+
+#include "ns3/log.h"
+#include "ns3/double.h"
+#include "ns3/uinteger.h"
+#include "ns3/simulator.h"
+
+#include "entanglement-pool.h"
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("EntanglementPool");
+
+NS_OBJECT_ENSURE_REGISTERED (EntanglementPool);
+
+const uint32_t EntanglementPool::NO_DEPOSITOR;
+
+TypeId
+EntanglementPool::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::EntanglementPool")
+    .SetParent<Object> ()
+    .SetGroupName ("Internet")
+    .AddConstructor<EntanglementPool> ()
+    .AddAttribute ("GenerationRate",
+                   "Entanglement pairs generated per second, besides the ones "
+                   "established by the QED records",
+                   DoubleValue (0.0),
+                   MakeDoubleAccessor (&EntanglementPool::m_rate),
+                   MakeDoubleChecker<double> (0.0))
+    .AddAttribute ("Capacity",
+                   "Maximum number of pairs stored (0 means no limit)",
+                   UintegerValue (0),
+                   MakeUintegerAccessor (&EntanglementPool::m_capacity),
+                   MakeUintegerChecker<uint32_t> ())
+    .AddTraceSource ("Pairs",
+                     "Number of entanglement pairs stored",
+                     MakeTraceSourceAccessor (&EntanglementPool::m_pairs),
+                     "ns3::TracedValueCallback::Uint32")
+  ;
+  return tid;
+}
+
+EntanglementPool::EntanglementPool ()
+  : m_rate (0.0),
+    m_capacity (0),
+    m_pairs (0),
+    m_generated (0),
+    m_decohered (0),
+    m_credit (0.0),
+    m_lastGeneration (Simulator::Now ()),
+    m_esQseq (0),
+    m_esQseqSet (false)
+{
+  NS_LOG_FUNCTION (this);
+  m_rng = CreateObject<UniformRandomVariable> ();
+}
+
+EntanglementPool::~EntanglementPool ()
+{
+  NS_LOG_FUNCTION (this);
+}
+
+uint32_t
+EntanglementPool::AddDepositor (void)
+{
+  NS_LOG_FUNCTION (this);
+  Depositor d;
+  d.decohered = 0;
+  d.taken = 0;
+  m_depositors.push_back (d);
+  return m_depositors.size () - 1;
+}
+
+uint32_t
+EntanglementPool::Deposit (uint32_t pairs, Time expiry, uint32_t depositor)
+{
+  NS_LOG_FUNCTION (this << pairs << expiry << depositor);
+  NS_ASSERT (depositor == NO_DEPOSITOR || depositor < m_depositors.size ());
+  Generate ();
+  Expire ();
+
+  uint32_t room = m_capacity == 0 ? pairs : m_capacity - std::min (m_capacity, m_pairs.Get ());
+  if (pairs > room)
+    {
+      NS_LOG_LOGIC ("Pool full, dropping " << pairs - room << " pairs");
+      pairs = room;
+    }
+  StoredPair pair;
+  pair.expiry = expiry;
+  pair.depositor = depositor;
+  for (uint32_t i = 0; i < pairs; ++i)
+    {
+      m_deadlines.push (pair);
+    }
+  UpdatePairs ();
+  Expire ();
+  return pairs;
+}
+
+Time
+EntanglementPool::Consume (uint32_t consumer, uint32_t *depositor)
+{
+  NS_LOG_FUNCTION (this << consumer);
+  Generate ();
+  Expire ();
+
+  if (depositor != 0)
+    {
+      *depositor = NO_DEPOSITOR;
+    }
+  if (m_pairs == 0)
+    {
+      NS_LOG_WARN ("No entanglement pair available");
+      return Time::Min ();
+    }
+
+  // The pairs that do not decohere are the last ones taken, the generated
+  // ones after the deposited ones
+  Time expiry = Time::Max ();
+  uint32_t owner = NO_DEPOSITOR;
+  if (!m_deadlines.empty ())
+    {
+      expiry = m_deadlines.top ().expiry;
+      owner = m_deadlines.top ().depositor;
+      m_deadlines.pop ();
+      if (owner != NO_DEPOSITOR && owner != consumer)
+        {
+          ++m_depositors[owner].taken;
+        }
+    }
+  else
+    {
+      --m_generated;
+    }
+  UpdatePairs ();
+  if (depositor != 0)
+    {
+      *depositor = owner;
+    }
+  return expiry;
+}
+
+uint32_t
+EntanglementPool::GetAvailable (void)
+{
+  Generate ();
+  Expire ();
+  return m_pairs;
+}
+
+uint32_t
+EntanglementPool::Reclaim (uint32_t depositor)
+{
+  NS_ASSERT (depositor < m_depositors.size ());
+  Expire ();
+  uint32_t pairs = m_depositors[depositor].decohered;
+  m_depositors[depositor].decohered = 0;
+  return pairs;
+}
+
+uint32_t
+EntanglementPool::CollectTaken (uint32_t depositor)
+{
+  NS_ASSERT (depositor < m_depositors.size ());
+  uint32_t pairs = m_depositors[depositor].taken;
+  m_depositors[depositor].taken = 0;
+  return pairs;
+}
+
+uint64_t
+EntanglementPool::GetDecoheredCount (void) const
+{
+  return m_decohered;
+}
+
+uint32_t
+EntanglementPool::AllocateEsQseq (void)
+{
+  if (!m_esQseqSet)
+    {
+      m_esQseq = m_rng->GetInteger (1, 0x7fffffff);
+      m_esQseqSet = true;
+    }
+  return m_esQseq++;
+}
+
+int64_t
+EntanglementPool::AssignStreams (int64_t stream)
+{
+  NS_LOG_FUNCTION (this << stream);
+  m_rng->SetStream (stream);
+  return 1;
+}
+
+void
+EntanglementPool::Generate (void)
+{
+  Time now = Simulator::Now ();
+  if (m_rate <= 0.0 || now <= m_lastGeneration)
+    {
+      m_lastGeneration = now;
+      return;
+    }
+
+  m_credit += m_rate * (now - m_lastGeneration).GetSeconds ();
+  m_lastGeneration = now;
+
+  double whole = floor (m_credit);
+  m_credit -= whole;
+
+  uint32_t generated = static_cast<uint32_t> (std::min (whole, 4294967295.0));
+  if (m_capacity != 0 && m_pairs + static_cast<uint64_t> (generated) >= m_capacity)
+    {
+      // A full pool does not bank the generation
+      generated = m_capacity - std::min (m_capacity, m_pairs.Get ());
+      m_credit = 0.0;
+    }
+  m_generated += generated;
+  UpdatePairs ();
+}
+
+void
+EntanglementPool::Expire (void)
+{
+  Time now = Simulator::Now ();
+  bool expired = false;
+  while (!m_deadlines.empty () && m_deadlines.top ().expiry <= now)
+    {
+      const StoredPair &pair = m_deadlines.top ();
+      NS_LOG_LOGIC ("Pair of depositor " << pair.depositor << " decohered at " << pair.expiry);
+      if (pair.depositor != NO_DEPOSITOR)
+        {
+          ++m_depositors[pair.depositor].decohered;
+        }
+      m_deadlines.pop ();
+      ++m_decohered;
+      expired = true;
+    }
+  if (expired)
+    {
+      UpdatePairs ();
+    }
+}
+
+void
+EntanglementPool::UpdatePairs (void)
+{
+  m_pairs = m_deadlines.size () + m_generated;
+}
+
+} // namespace ns3
@@ -0,0 +1,215 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef ENTANGLEMENT_POOL_H
+#define ENTANGLEMENT_POOL_H
+
+#include <stdint.h>
+#include <vector>
+#include <queue>
+#include <functional>
+#include "ns3/object.h"
+#include "ns3/nstime.h"
+#include "ns3/traced-value.h"
+#include "ns3/random-variable-stream.h"
+
+namespace ns3 {
+
+/**
+ * \ingroup tcp
+ * \brief Entanglement pairs established between two nodes
+ *
+ * QTCP stores here the pairs established by the acknowledged QED records,
+ * and takes one for every SEND record it transmits. The pool can also
+ * generate pairs on its own, at GenerationRate pairs per second, to model
+ * entanglement that is distributed ahead of the demand; the generation is
+ * computed when the pool is queried, no event is scheduled. At most Capacity
+ * pairs are stored.
+ *
+ * A pair kept in a quantum memory decoheres: a pair can be stored with the
+ * time at which it expires, and it is removed from the pool at that time.
+ * Consume() takes the pair that expires first (earliest deadline first), so
+ * that the SEND records use the pairs before they decohere; the generated
+ * pairs do not expire, and are taken last. Every stored pair remembers its
+ * depositor (see AddDepositor), and the pairs that decohered are counted for
+ * their depositor until it reclaims them, so that each sender establishes
+ * new ones only for its own pairs.
+ *
+ * The pool also numbers the entanglements carried by the QED records
+ * (esQseq), starting from a random value.
+ *
+ * Every TcpTxBuffer creates its own pool, unless one is given with its
+ * EntanglementPool attribute: the connections between the same pair of nodes
+ * can share a pool in this way.
+ */
+class EntanglementPool : public Object
+{
+public:
+  /**
+   * \brief Get the type ID.
+   * \return the object TypeId
+   */
+  static TypeId GetTypeId (void);
+
+  /// Depositor of the pairs stored on behalf of nobody
+  static const uint32_t NO_DEPOSITOR = 0xffffffff;
+
+  EntanglementPool ();
+  virtual ~EntanglementPool ();
+
+  /**
+   * \brief Register a user of the pool which deposits pairs
+   * \return the identifier to give to Deposit and Reclaim
+   */
+  uint32_t AddDepositor (void);
+
+  /**
+   * \brief Store established pairs
+   * \param pairs number of pairs (dropped above the capacity)
+   * \param expiry time at which the pairs decohere (Time::Max () if they
+   * do not)
+   * \param depositor identifier from AddDepositor, or NO_DEPOSITOR
+   * \return the number of pairs stored; the depositor has to replace the
+   * others
+   */
+  uint32_t Deposit (uint32_t pairs = 1, Time expiry = Time::Max (),
+                    uint32_t depositor = NO_DEPOSITOR);
+
+  /**
+   * \brief Take the pair that expires first
+   *
+   * A pair of another depositor is counted for it, see CollectTaken.
+   *
+   * \param consumer identifier of the depositor taking the pair, or
+   * NO_DEPOSITOR
+   * \param depositor if not 0, set to the depositor of the pair taken
+   * (NO_DEPOSITOR for a generated pair)
+   * \return the time at which the pair decoheres (Time::Max () if it does
+   * not), or Time::Min () if the pool is empty
+   */
+  Time Consume (uint32_t consumer = NO_DEPOSITOR, uint32_t *depositor = 0);
+
+  /**
+   * \brief Get the number of pairs stored, generation included
+   * \return the number of pairs
+   */
+  uint32_t GetAvailable (void);
+
+  /**
+   * \brief Get the pairs of a depositor that decohered since its last call
+   * \param depositor identifier from AddDepositor
+   * \return the number of pairs
+   */
+  uint32_t Reclaim (uint32_t depositor);
+
+  /**
+   * \brief Get the pairs of a depositor taken by other consumers since its
+   * last call
+   * \param depositor identifier from AddDepositor
+   * \return the number of pairs
+   */
+  uint32_t CollectTaken (uint32_t depositor);
+
+  /**
+   * \brief Get the number of pairs that decohered before being used
+   * \return the number of pairs
+   */
+  uint64_t GetDecoheredCount (void) const;
+
+  /**
+   * \brief Get the entanglement sequence number of a new QED record
+   * \return the sequence number
+   */
+  uint32_t AllocateEsQseq (void);
+
+  /**
+   * \brief Assign a fixed random variable stream number to the random
+   * variables used by this model.
+   *
+   * \param stream first stream index to use
+   * \return the number of stream indices assigned by this model
+   */
+  int64_t AssignStreams (int64_t stream);
+
+private:
+  /**
+   * \brief Add the pairs generated since the last update
+   */
+  void Generate (void);
+
+  /**
+   * \brief Remove the pairs that decohered
+   */
+  void Expire (void);
+
+  /**
+   * \brief Update m_pairs from the deposited and the generated pairs
+   */
+  void UpdatePairs (void);
+
+  /**
+   * \brief A pair stored by a depositor
+   */
+  struct StoredPair
+  {
+    Time expiry;        //!< Time at which the pair decoheres
+    uint32_t depositor; //!< Depositor of the pair
+  };
+
+  /**
+   * \brief Order of the heap: the pair that expires first on top
+   */
+  struct ExpiresLater
+  {
+    /**
+     * \param a first pair
+     * \param b second pair
+     * \return true if a expires after b
+     */
+    bool operator() (const StoredPair &a, const StoredPair &b) const
+    {
+      return a.expiry > b.expiry;
+    }
+  };
+
+  /// Deposited pairs, the earliest to decohere on top
+  typedef std::priority_queue<StoredPair, std::vector<StoredPair>, ExpiresLater> DeadlineHeap;
+
+  double m_rate;                   //!< Generated pairs per second
+  uint32_t m_capacity;             //!< Maximum number of pairs stored (0: no limit)
+  TracedValue<uint32_t> m_pairs;   //!< Pairs stored
+  DeadlineHeap m_deadlines;        //!< Deposited pairs
+  uint32_t m_generated;            //!< Generated pairs stored
+  /**
+   * \brief Pairs of a depositor that left the pool without its knowledge
+   */
+  struct Depositor
+  {
+    uint32_t decohered; //!< Pairs decohered since the last Reclaim ()
+    uint32_t taken;     //!< Pairs taken by others since the last CollectTaken ()
+  };
+  std::vector<Depositor> m_depositors; //!< Indexed by depositor identifier
+  uint64_t m_decohered;            //!< Pairs decohered
+  double m_credit;                 //!< Fraction of pair generated and not stored yet
+  Time m_lastGeneration;           //!< Time of the last generation update
+  uint32_t m_esQseq;               //!< Next entanglement sequence number
+  bool m_esQseqSet;                //!< m_esQseq has been drawn
+  Ptr<UniformRandomVariable> m_rng; //!< Draws the first entanglement sequence number
+};
+
+} // namespace ns3
+
+#endif /* ENTANGLEMENT_POOL_H */
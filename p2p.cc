@@ -80,6 +80,9 @@ int main (int argc, char *argv[]) {
                      UintegerValue(HEADER_SIZE)); 
   Config::SetDefault("ns3::TcpTxBuffer::REDSIZE",
                      UintegerValue(RED_SIZE)); 
+  // The sink gets only the SEND payload: its counters are the qubit goodput.
+  Config::SetDefault("ns3::TcpSocketBase::QtcpDecoding",
+                     BooleanValue(true));
 
   // Turn off delayed ack (so, acks every packet).
   // Note, BBR' still works without this.
@@ -225,7 +228,7 @@ int main (int argc, char *argv[]) {
 	    	        NS_LOG_INFO( "timeFirstTxPacket = " << i->second.timeFirstTxPacket.GetSeconds() << "\n");
 	    	        NS_LOG_INFO( "timeLastRxPacket = " << i->second.timeLastRxPacket.GetSeconds() << "\n");
 	    	        localThrou2 = i->second.rxBytes * 8.0 / (i->second.timeLastRxPacket.GetSeconds() - i->second.timeFirstTxPacket.GetSeconds())/1024/1024;
-	    	        localThrou3=MAX_BYTES* 4.0 / (i->second.timeLastRxPacket.GetSeconds() - i->second.timeFirstTxPacket.GetSeconds())/1024/1024;
+	    	        localThrou3=p_sink->GetTotalRx()* 4.0 / (i->second.timeLastRxPacket.GetSeconds() - i->second.timeFirstTxPacket.GetSeconds())/1024/1024;
 	    	        NS_LOG_INFO( "TxThroughput: " <<  localThrou2 << " Mbps\n");
 	    	        NS_LOG_INFO( "Real RxThroughput: " <<  localThrou3 << " Mqbps\n");
 	    	        NS_LOG_INFO( "--------------------------------------------\n");
@@ -235,7 +238,7 @@ int main (int argc, char *argv[]) {
 
   /////////////////////////////////////////
   // Ouput stats.
-  NS_LOG_INFO("Total bytes received: " << p_sink->GetTotalRx()/(PACKET_SIZE+HEADER_SIZE+RED_SIZE)*PACKET_SIZE);
+  NS_LOG_INFO("Total bytes received: " << p_sink->GetTotalRx());
   NS_LOG_INFO("Done.");
 
   // Done.
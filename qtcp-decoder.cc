@@ -0,0 +1,170 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <algorithm>
+
+#include "ns3/log.h"
+
+#include "qtcp-decoder.h"
+#include "qtcp-header.h"
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("QtcpDecoder");
+
+QtcpDecoder::QtcpDecoder ()
+  : m_pending (0),
+    m_payloadLeft (0),
+    m_trailer (0),
+    m_raw (false),
+    m_dropped (0)
+{
+}
+
+void
+QtcpDecoder::Push (Ptr<Packet> data)
+{
+  NS_LOG_FUNCTION (this << data);
+
+  if (data == 0 || data->GetSize () == 0)
+    {
+      return;
+    }
+
+  if (m_pending == 0 || m_pending->GetSize () == 0)
+    {
+      m_pending = data;
+    }
+  else
+    {
+      m_pending->AddAtEnd (data);
+    }
+}
+
+Ptr<Packet>
+QtcpDecoder::Pop (uint32_t maxSize)
+{
+  NS_LOG_FUNCTION (this << maxSize);
+
+  if (maxSize == 0 || Decode () == 0)
+    {
+      return 0;
+    }
+
+  // Give back (a part of) the current payload
+  uint32_t size = std::min (maxSize, GetAvailable ());
+  Ptr<Packet> out = m_pending->CreateFragment (0, size);
+  m_pending->RemoveAtStart (size);
+
+  if (!m_raw)
+    {
+      m_payloadLeft -= size;
+      if (m_payloadLeft == 0)
+        {
+          Drop (m_trailer);
+          m_trailer = 0;
+        }
+    }
+  return out;
+}
+
+uint32_t
+QtcpDecoder::Decode (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  while (m_pending != 0 && m_pending->GetSize () > 0 && GetAvailable () == 0)
+    {
+      // The head of the stream is the header of a record: the fixed part
+      // tells the length of the whole header
+      if (m_pending->GetSize () < QtcpHeader::MIN_LENGTH)
+        {
+          break;
+        }
+
+      uint8_t fixed[QtcpHeader::MIN_LENGTH];
+      m_pending->CopyData (fixed, QtcpHeader::MIN_LENGTH);
+      uint16_t headerLength = QtcpHeader::PeekHeaderLength (fixed);
+      if (headerLength == 0)
+        {
+          NS_LOG_WARN ("The stream is not made of QTCP records, giving it back as is");
+          m_raw = true;
+          break;
+        }
+      if (m_pending->GetSize () < headerLength)
+        {
+          break;
+        }
+
+      QtcpHeader header;
+      m_pending->PeekHeader (header);
+      if (m_pending->GetSize () < header.GetRecordLength ())
+        {
+          break;
+        }
+
+      NS_LOG_LOGIC ("Decoding " << header);
+      if (header.GetMessageType () == QtcpHeader::QED)
+        {
+          Drop (header.GetRecordLength ());
+        }
+      else
+        {
+          Drop (headerLength);
+          m_payloadLeft = header.GetPayloadLength ();
+          m_trailer = header.GetRedundancyLength ();
+          if (m_payloadLeft == 0)
+            {
+              Drop (m_trailer);
+              m_trailer = 0;
+            }
+        }
+    }
+
+  return GetAvailable ();
+}
+
+uint32_t
+QtcpDecoder::GetAvailable (void) const
+{
+  if (m_raw)
+    {
+      return GetPendingSize ();
+    }
+  return m_payloadLeft;
+}
+
+uint32_t
+QtcpDecoder::GetPendingSize (void) const
+{
+  return m_pending == 0 ? 0 : m_pending->GetSize ();
+}
+
+uint64_t
+QtcpDecoder::GetDroppedBytes (void) const
+{
+  return m_dropped;
+}
+
+void
+QtcpDecoder::Drop (uint32_t size)
+{
+  NS_ASSERT (m_pending->GetSize () >= size);
+  m_pending->RemoveAtStart (size);
+  m_dropped += size;
+}
+
+} // namespace ns3
@@ -0,0 +1,102 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef QTCP_DECODER_H
+#define QTCP_DECODER_H
+
+#include <stdint.h>
+#include "ns3/ptr.h"
+#include "ns3/packet.h"
+
+namespace ns3 {
+
+/**
+ * \ingroup tcp
+ * \brief Receive-side parser of the QTCP records of a TCP stream
+ *
+ * The in-order bytes of the stream are pushed into the decoder, which parses
+ * the QtcpHeader of each record and gives back only the payload of the SEND
+ * records. QED records, headers and redundancy are dropped. The payload is
+ * cut out of the stream with fragment operations, so its bytes are not
+ * copied.
+ *
+ * A record is decoded only when it is complete. If the stream does not start
+ * with a QTCP header (e.g., the peer does not frame its data), the bytes are
+ * given back as they are.
+ */
+class QtcpDecoder
+{
+public:
+  QtcpDecoder ();
+
+  /**
+   * \brief Append in-order bytes of the stream
+   * \param data the bytes
+   */
+  void Push (Ptr<Packet> data);
+
+  /**
+   * \brief Get the next SEND payload bytes
+   * \param maxSize maximum number of bytes to return
+   * \return up to maxSize bytes of payload, or 0 if no complete SEND record
+   * is buffered
+   */
+  Ptr<Packet> Pop (uint32_t maxSize);
+
+  /**
+   * \brief Parse the records at the head of the stream, dropping the QED
+   * records, until the payload of a complete SEND record is ready
+   * \return the payload bytes that Pop can give back now
+   */
+  uint32_t Decode (void);
+
+  /**
+   * \brief Get the payload bytes that Pop can give back without parsing
+   * another record
+   * \return the number of bytes (0 until Decode finds a complete SEND)
+   */
+  uint32_t GetAvailable (void) const;
+
+  /**
+   * \brief Get the bytes pushed but not given back nor dropped yet
+   * \return the number of bytes
+   */
+  uint32_t GetPendingSize (void) const;
+
+  /**
+   * \brief Get the bytes of framing dropped so far (headers, redundancy and
+   * QED records)
+   * \return the number of bytes
+   */
+  uint64_t GetDroppedBytes (void) const;
+
+private:
+  /**
+   * \brief Remove bytes from the head of the stream
+   * \param size number of bytes
+   */
+  void Drop (uint32_t size);
+
+  Ptr<Packet> m_pending;  //!< Bytes of the stream not decoded yet
+  uint32_t m_payloadLeft; //!< Payload of the current SEND not given back yet
+  uint32_t m_trailer;     //!< Redundancy that follows the current SEND payload
+  bool m_raw;             //!< The stream is not framed: give back every byte
+  uint64_t m_dropped;     //!< Bytes of framing dropped
+};
+
+} // namespace ns3
+
+#endif /* QTCP_DECODER_H */
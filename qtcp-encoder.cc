@@ -0,0 +1,338 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <string.h>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "ns3/log.h"
+#include "ns3/uinteger.h"
+
+#include "qtcp-encoder.h"
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("QtcpEncoder");
+
+NS_OBJECT_ENSURE_REGISTERED (QtcpEncoder);
+
+TypeId
+QtcpEncoder::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::QtcpEncoder")
+    .SetParent<Object> ()
+    .SetGroupName ("Internet")
+  ;
+  return tid;
+}
+
+QtcpEncoder::QtcpEncoder ()
+{
+}
+
+QtcpEncoder::~QtcpEncoder ()
+{
+}
+
+// QtcpOffsetEncoder
+
+NS_OBJECT_ENSURE_REGISTERED (QtcpOffsetEncoder);
+
+TypeId
+QtcpOffsetEncoder::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::QtcpOffsetEncoder")
+    .SetParent<QtcpEncoder> ()
+    .SetGroupName ("Internet")
+    .AddConstructor<QtcpOffsetEncoder> ()
+    .AddAttribute ("Offset", "Value added to every byte of the body",
+                   UintegerValue (49),
+                   MakeUintegerAccessor (&QtcpOffsetEncoder::m_offset),
+                   MakeUintegerChecker<uint8_t> ())
+  ;
+  return tid;
+}
+
+QtcpOffsetEncoder::QtcpOffsetEncoder ()
+  : QtcpEncoder (),
+    m_offset (49)
+{
+}
+
+QtcpOffsetEncoder::~QtcpOffsetEncoder ()
+{
+}
+
+std::string
+QtcpOffsetEncoder::GetName (void) const
+{
+  return "QtcpOffsetEncoder";
+}
+
+void
+QtcpOffsetEncoder::Encode (uint8_t *body, uint32_t payloadSize, uint32_t redundancy)
+{
+  NS_LOG_FUNCTION (this << payloadSize << redundancy);
+
+  uint32_t size = payloadSize + redundancy;
+  uint32_t i = 0;
+
+#if defined(__AVX2__)
+  __m256i offset256 = _mm256_set1_epi8 (static_cast<char> (m_offset));
+  for (; i + 32 <= size; i += 32)
+    {
+      __m256i v = _mm256_loadu_si256 (reinterpret_cast<const __m256i *> (body + i));
+      _mm256_storeu_si256 (reinterpret_cast<__m256i *> (body + i), _mm256_add_epi8 (v, offset256));
+    }
+#endif
+#if defined(__SSE2__)
+  __m128i offset128 = _mm_set1_epi8 (static_cast<char> (m_offset));
+  for (; i + 16 <= size; i += 16)
+    {
+      __m128i v = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (body + i));
+      _mm_storeu_si128 (reinterpret_cast<__m128i *> (body + i), _mm_add_epi8 (v, offset128));
+    }
+#endif
+
+  for (; i < size; ++i)
+    {
+      body[i] += m_offset;
+    }
+}
+
+// QtcpReedSolomonEncoder
+
+namespace {
+
+/**
+ * \brief Log and exp tables of GF(256), with the polynomial 0x11d
+ */
+struct GaloisTables
+{
+  GaloisTables ()
+  {
+    uint32_t x = 1;
+    for (uint32_t i = 0; i < 255; ++i)
+      {
+        exp[i] = static_cast<uint8_t> (x);
+        exp[i + 255] = static_cast<uint8_t> (x);
+        log[x] = static_cast<uint8_t> (i);
+        x <<= 1;
+        if (x & 0x100)
+          {
+            x ^= 0x11d;
+          }
+      }
+    exp[510] = exp[0];
+    exp[511] = exp[1];
+    log[0] = 0;
+  }
+
+  uint8_t exp[512]; //!< exp[i] = 2^i, doubled to skip the modulo
+  uint8_t log[256]; //!< log[2^i] = i
+};
+
+const GaloisTables &
+GetGaloisTables (void)
+{
+  static GaloisTables tables;
+  return tables;
+}
+
+} // anonymous namespace
+
+NS_OBJECT_ENSURE_REGISTERED (QtcpReedSolomonEncoder);
+
+TypeId
+QtcpReedSolomonEncoder::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::QtcpReedSolomonEncoder")
+    .SetParent<QtcpEncoder> ()
+    .SetGroupName ("Internet")
+    .AddConstructor<QtcpReedSolomonEncoder> ()
+    .AddAttribute ("ParityShards", "Number of parity shards in the redundancy "
+                   "area (number of lost shards that can be recovered)",
+                   UintegerValue (2),
+                   MakeUintegerAccessor (&QtcpReedSolomonEncoder::m_parityShards),
+                   MakeUintegerChecker<uint32_t> (1, 255))
+  ;
+  return tid;
+}
+
+QtcpReedSolomonEncoder::QtcpReedSolomonEncoder ()
+  : QtcpEncoder (),
+    m_parityShards (2),
+    m_k (0),
+    m_m (0)
+{
+}
+
+QtcpReedSolomonEncoder::~QtcpReedSolomonEncoder ()
+{
+}
+
+std::string
+QtcpReedSolomonEncoder::GetName (void) const
+{
+  return "QtcpReedSolomonEncoder";
+}
+
+uint8_t
+QtcpReedSolomonEncoder::Multiply (uint8_t a, uint8_t b)
+{
+  if (a == 0 || b == 0)
+    {
+      return 0;
+    }
+  const GaloisTables &gf = GetGaloisTables ();
+  return gf.exp[gf.log[a] + gf.log[b]];
+}
+
+uint8_t
+QtcpReedSolomonEncoder::Inverse (uint8_t a)
+{
+  NS_ASSERT (a != 0);
+  const GaloisTables &gf = GetGaloisTables ();
+  return gf.exp[255 - gf.log[a]];
+}
+
+void
+QtcpReedSolomonEncoder::PrepareMatrix (uint32_t k, uint32_t m)
+{
+  if (k == m_k && m == m_m)
+    {
+      return;
+    }
+  NS_LOG_FUNCTION (this << k << m);
+  NS_ASSERT (k + m <= 256);
+
+  // Cauchy matrix: entry (j, i) = 1 / (x_j + y_i), with x_j = j and
+  // y_i = m + i, all distinct. Every square submatrix is invertible, which
+  // makes the code MDS.
+  m_tables.resize (static_cast<size_t> (k) * m * 32);
+  for (uint32_t j = 0; j < m; ++j)
+    {
+      for (uint32_t i = 0; i < k; ++i)
+        {
+          uint8_t c = Inverse (static_cast<uint8_t> (j ^ (m + i)));
+          uint8_t *t = &m_tables[(static_cast<size_t> (j) * k + i) * 32];
+          for (uint32_t x = 0; x < 16; ++x)
+            {
+              t[x] = Multiply (c, static_cast<uint8_t> (x));
+              t[16 + x] = Multiply (c, static_cast<uint8_t> (x << 4));
+            }
+        }
+    }
+  m_k = k;
+  m_m = m;
+}
+
+void
+QtcpReedSolomonEncoder::MultiplyAdd (uint8_t *dst, const uint8_t *src, uint32_t len,
+                                     const uint8_t *tables)
+{
+  uint32_t i = 0;
+
+#if defined(__AVX2__)
+  __m256i lo256 = _mm256_broadcastsi128_si256 (_mm_loadu_si128 (reinterpret_cast<const __m128i *> (tables)));
+  __m256i hi256 = _mm256_broadcastsi128_si256 (_mm_loadu_si128 (reinterpret_cast<const __m128i *> (tables + 16)));
+  __m256i mask256 = _mm256_set1_epi8 (0x0f);
+  for (; i + 32 <= len; i += 32)
+    {
+      __m256i s = _mm256_loadu_si256 (reinterpret_cast<const __m256i *> (src + i));
+      __m256i d = _mm256_loadu_si256 (reinterpret_cast<const __m256i *> (dst + i));
+      __m256i l = _mm256_shuffle_epi8 (lo256, _mm256_and_si256 (s, mask256));
+      __m256i h = _mm256_shuffle_epi8 (hi256, _mm256_and_si256 (_mm256_srli_epi64 (s, 4), mask256));
+      d = _mm256_xor_si256 (d, _mm256_xor_si256 (l, h));
+      _mm256_storeu_si256 (reinterpret_cast<__m256i *> (dst + i), d);
+    }
+#endif
+#if defined(__AVX2__) || defined(__SSSE3__)
+  __m128i lo128 = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (tables));
+  __m128i hi128 = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (tables + 16));
+  __m128i mask128 = _mm_set1_epi8 (0x0f);
+  for (; i + 16 <= len; i += 16)
+    {
+      __m128i s = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (src + i));
+      __m128i d = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (dst + i));
+      __m128i l = _mm_shuffle_epi8 (lo128, _mm_and_si128 (s, mask128));
+      __m128i h = _mm_shuffle_epi8 (hi128, _mm_and_si128 (_mm_srli_epi64 (s, 4), mask128));
+      d = _mm_xor_si128 (d, _mm_xor_si128 (l, h));
+      _mm_storeu_si128 (reinterpret_cast<__m128i *> (dst + i), d);
+    }
+#endif
+
+  for (; i < len; ++i)
+    {
+      dst[i] ^= tables[src[i] & 0x0f] ^ tables[16 + (src[i] >> 4)];
+    }
+}
+
+void
+QtcpReedSolomonEncoder::Encode (uint8_t *body, uint32_t payloadSize, uint32_t redundancy)
+{
+  NS_LOG_FUNCTION (this << payloadSize << redundancy);
+
+  uint8_t *parity = body + payloadSize;
+  memset (parity, 0, redundancy);
+
+  if (payloadSize == 0 || redundancy == 0)
+    {
+      return;
+    }
+
+  // Shard length L and number of data shards k, so that the m parity
+  // shards fit in the redundancy area and k + m <= 256
+  uint32_t m = std::min (m_parityShards, redundancy);
+  uint32_t shard = redundancy / m;
+  uint32_t k = (payloadSize + shard - 1) / shard;
+  if (k + m > 256)
+    {
+      shard = (payloadSize + (256 - m) - 1) / (256 - m);
+      m = redundancy / shard;
+      if (m == 0)
+        {
+          NS_LOG_WARN ("Redundancy of " << redundancy << " bytes is too short "
+                       "to protect " << payloadSize << " bytes, leaving it empty");
+          return;
+        }
+      k = (payloadSize + shard - 1) / shard;
+    }
+
+  PrepareMatrix (k, m);
+
+  for (uint32_t j = 0; j < m; ++j)
+    {
+      uint8_t *out = parity + j * shard;
+      for (uint32_t i = 0; i < k; ++i)
+        {
+          // The last shard is shorter: its padding is zero, and adds nothing
+          uint32_t begin = i * shard;
+          uint32_t len = std::min (shard, payloadSize - begin);
+          MultiplyAdd (out, body + begin, len,
+                       &m_tables[(static_cast<size_t> (j) * k + i) * 32]);
+        }
+    }
+}
+
+} // namespace ns3
@@ -0,0 +1,164 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef QTCP_ENCODER_H
+#define QTCP_ENCODER_H
+
+#include <stdint.h>
+#include <vector>
+#include "ns3/object.h"
+
+namespace ns3 {
+
+/**
+ * \ingroup tcp
+ * \brief Redundancy encoder of the QED records
+ *
+ * The encoder receives the body of a QED record (payload followed by the
+ * redundancy area) and encodes it in place. TcpTxBuffer owns the body
+ * buffer and reuses it for every record, so encoders must not keep pointers
+ * to it.
+ *
+ * The encoder used by TcpTxBuffer is chosen with its EncoderType attribute.
+ */
+class QtcpEncoder : public Object
+{
+public:
+  /**
+   * \brief Get the type ID.
+   * \return the object TypeId
+   */
+  static TypeId GetTypeId (void);
+
+  QtcpEncoder ();
+  virtual ~QtcpEncoder ();
+
+  /**
+   * \brief Encode a QED body in place
+   *
+   * \param body the body, payloadSize + redundancy bytes long
+   * \param payloadSize bytes of payload at the beginning of body
+   * \param redundancy bytes of redundancy area after the payload
+   */
+  virtual void Encode (uint8_t *body, uint32_t payloadSize, uint32_t redundancy) = 0;
+
+  /**
+   * \brief Get the name of the encoder
+   * \return the name
+   */
+  virtual std::string GetName (void) const = 0;
+};
+
+/**
+ * \ingroup tcp
+ * \brief The original QTCP imitation encoder
+ *
+ * Every byte of the body (payload and redundancy area) is incremented by a
+ * constant offset (49 by default). Whole vectors are processed at a time with
+ * AVX2 or SSE2, when the module is compiled for them.
+ */
+class QtcpOffsetEncoder : public QtcpEncoder
+{
+public:
+  /**
+   * \brief Get the type ID.
+   * \return the object TypeId
+   */
+  static TypeId GetTypeId (void);
+
+  QtcpOffsetEncoder ();
+  virtual ~QtcpOffsetEncoder ();
+
+  virtual void Encode (uint8_t *body, uint32_t payloadSize, uint32_t redundancy);
+  virtual std::string GetName (void) const;
+
+private:
+  uint8_t m_offset; //!< Offset added to each byte
+};
+
+/**
+ * \ingroup tcp
+ * \brief Systematic Reed-Solomon erasure code over GF(256)
+ *
+ * The payload is sent as is, and it is cut in k data shards of L bytes (the
+ * last one is padded with zeros). The redundancy area holds m parity shards
+ * of L bytes, computed with a Cauchy matrix: any m shards lost out of the
+ * k + m can be rebuilt. L and k are derived from the redundancy length and the
+ * ParityShards attribute, such that m * L <= redundancy and k + m <= 256;
+ * the unused part of the redundancy area is zeroed.
+ *
+ * Multiplications by a constant use two 16-entry tables (low and high
+ * nibble), so that whole vectors are multiplied with one byte shuffle each
+ * when the module is compiled for SSSE3 or AVX2.
+ */
+class QtcpReedSolomonEncoder : public QtcpEncoder
+{
+public:
+  /**
+   * \brief Get the type ID.
+   * \return the object TypeId
+   */
+  static TypeId GetTypeId (void);
+
+  QtcpReedSolomonEncoder ();
+  virtual ~QtcpReedSolomonEncoder ();
+
+  virtual void Encode (uint8_t *body, uint32_t payloadSize, uint32_t redundancy);
+  virtual std::string GetName (void) const;
+
+  /**
+   * \brief Multiply two elements of GF(256)
+   * \param a first element
+   * \param b second element
+   * \return a * b
+   */
+  static uint8_t Multiply (uint8_t a, uint8_t b);
+
+  /**
+   * \brief Invert an element of GF(256)
+   * \param a the element (not zero)
+   * \return 1 / a
+   */
+  static uint8_t Inverse (uint8_t a);
+
+private:
+  /**
+   * \brief Build the nibble tables of the Cauchy matrix for k data shards and
+   * m parity shards, if they are not already built
+   * \param k data shards
+   * \param m parity shards
+   */
+  void PrepareMatrix (uint32_t k, uint32_t m);
+
+  /**
+   * \brief dst ^= c * src, where c is described by its nibble tables
+   * \param dst destination
+   * \param src source
+   * \param len bytes to process
+   * \param tables 32 bytes: c * x for x in [0, 16), then c * (x << 4)
+   */
+  static void MultiplyAdd (uint8_t *dst, const uint8_t *src, uint32_t len,
+                           const uint8_t *tables);
+
+  uint32_t m_parityShards;        //!< Requested number of parity shards
+  uint32_t m_k;                   //!< Data shards of the prepared matrix
+  uint32_t m_m;                   //!< Parity shards of the prepared matrix
+  std::vector<uint8_t> m_tables;  //!< Nibble tables, 32 bytes per matrix entry
+};
+
+} // namespace ns3
+
+#endif /* QTCP_ENCODER_H */
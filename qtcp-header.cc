@@ -0,0 +1,268 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ns3/log.h"
+#include "ns3/abort.h"
+
+#include "qtcp-header.h"
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("QtcpHeader");
+
+NS_OBJECT_ENSURE_REGISTERED (QtcpHeader);
+
+QtcpHeader::QtcpHeader ()
+  : m_type (QED),
+    m_esQseq (0),
+    m_stageQseq (0),
+    m_sendQseq (0),
+    m_length (MIN_LENGTH),
+    m_redundancy (0),
+    m_payload (0),
+    m_valid (true)
+{
+}
+
+QtcpHeader::~QtcpHeader ()
+{
+}
+
+TypeId
+QtcpHeader::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::QtcpHeader")
+    .SetParent<Header> ()
+    .SetGroupName ("Internet")
+    .AddConstructor<QtcpHeader> ()
+  ;
+  return tid;
+}
+
+TypeId
+QtcpHeader::GetInstanceTypeId (void) const
+{
+  return GetTypeId ();
+}
+
+void
+QtcpHeader::Print (std::ostream &os) const
+{
+  if (m_type == QED)
+    {
+      os << "QED es=" << m_esQseq << " stage=" << m_stageQseq;
+    }
+  else
+    {
+      os << "SEND stage=" << m_stageQseq << " send=" << m_sendQseq;
+    }
+  os << " hdr=" << m_length << " payload=" << m_payload
+     << " red=" << static_cast<uint32_t> (m_redundancy);
+}
+
+uint32_t
+QtcpHeader::GetSerializedSize (void) const
+{
+  return m_length;
+}
+
+void
+QtcpHeader::Serialize (Buffer::Iterator start) const
+{
+  Buffer::Iterator i = start;
+
+  i.WriteU8 ('Q');
+  i.WriteU8 ('T');
+  i.WriteU8 ('C');
+  i.WriteU8 ('S');
+
+  if (m_type == QED)
+    {
+      i.WriteHtonU32 (m_esQseq);
+      i.WriteHtonU32 (m_stageQseq);
+    }
+  else
+    {
+      i.WriteHtonU32 (m_stageQseq);
+      i.WriteHtonU32 (m_sendQseq);
+    }
+
+  uint8_t type = 0x80 | (m_length >> 2);
+  if (m_type == SEND)
+    {
+      type |= 0x40;
+    }
+  i.WriteU8 (type);
+  i.WriteU8 (m_redundancy);
+  i.WriteHtonU16 (m_payload);
+
+  if (m_length > MIN_LENGTH)
+    {
+      i.WriteU8 (0, m_length - MIN_LENGTH);
+    }
+}
+
+uint32_t
+QtcpHeader::Deserialize (Buffer::Iterator start)
+{
+  Buffer::Iterator i = start;
+
+  uint8_t magic[4];
+  i.Read (magic, 4);
+  m_valid = (magic[0] == 'Q' && magic[1] == 'T' && magic[2] == 'C' && magic[3] == 'S');
+
+  uint32_t first = i.ReadNtohU32 ();
+  uint32_t second = i.ReadNtohU32 ();
+
+  uint8_t type = i.ReadU8 ();
+  m_valid = m_valid && (type & 0x80);
+  m_type = (type & 0x40) ? SEND : QED;
+  m_length = static_cast<uint16_t> (type & 0x3f) << 2;
+  if (m_length < MIN_LENGTH)
+    {
+      m_valid = false;
+      m_length = MIN_LENGTH;
+    }
+
+  if (m_type == QED)
+    {
+      m_esQseq = first;
+      m_stageQseq = second;
+    }
+  else
+    {
+      m_stageQseq = first;
+      m_sendQseq = second;
+    }
+
+  m_redundancy = i.ReadU8 ();
+  m_payload = i.ReadNtohU16 ();
+  i.Next (m_length - MIN_LENGTH);
+
+  return GetSerializedSize ();
+}
+
+void
+QtcpHeader::SetMessageType (MessageType_t type)
+{
+  m_type = type;
+}
+
+QtcpHeader::MessageType_t
+QtcpHeader::GetMessageType (void) const
+{
+  return m_type;
+}
+
+void
+QtcpHeader::SetEsQseq (uint32_t seq)
+{
+  m_esQseq = seq;
+}
+
+uint32_t
+QtcpHeader::GetEsQseq (void) const
+{
+  return m_esQseq;
+}
+
+void
+QtcpHeader::SetStageQseq (uint32_t seq)
+{
+  m_stageQseq = seq;
+}
+
+uint32_t
+QtcpHeader::GetStageQseq (void) const
+{
+  return m_stageQseq;
+}
+
+void
+QtcpHeader::SetSendQseq (uint32_t seq)
+{
+  m_sendQseq = seq;
+}
+
+uint32_t
+QtcpHeader::GetSendQseq (void) const
+{
+  return m_sendQseq;
+}
+
+void
+QtcpHeader::SetHeaderLength (uint16_t length)
+{
+  NS_ABORT_MSG_UNLESS (length >= MIN_LENGTH && length <= MAX_LENGTH && length % 4 == 0,
+                       "QTCP header length must be a multiple of 4 in [16, 252], got " << length);
+  m_length = length;
+}
+
+uint16_t
+QtcpHeader::GetHeaderLength (void) const
+{
+  return m_length;
+}
+
+void
+QtcpHeader::SetRedundancyLength (uint8_t length)
+{
+  m_redundancy = length;
+}
+
+uint8_t
+QtcpHeader::GetRedundancyLength (void) const
+{
+  return m_redundancy;
+}
+
+void
+QtcpHeader::SetPayloadLength (uint16_t length)
+{
+  m_payload = length;
+}
+
+uint16_t
+QtcpHeader::GetPayloadLength (void) const
+{
+  return m_payload;
+}
+
+uint32_t
+QtcpHeader::GetRecordLength (void) const
+{
+  return m_length + m_payload + m_redundancy;
+}
+
+bool
+QtcpHeader::IsValid (void) const
+{
+  return m_valid;
+}
+
+uint16_t
+QtcpHeader::PeekHeaderLength (const uint8_t *fixed)
+{
+  if (fixed[0] != 'Q' || fixed[1] != 'T' || fixed[2] != 'C' || fixed[3] != 'S'
+      || !(fixed[12] & 0x80))
+    {
+      return 0;
+    }
+  uint16_t length = static_cast<uint16_t> (fixed[12] & 0x3f) << 2;
+  return length >= MIN_LENGTH ? length : 0;
+}
+
+} // namespace ns3
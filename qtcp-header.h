@@ -0,0 +1,199 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef QTCP_HEADER_H
+#define QTCP_HEADER_H
+
+#include <stdint.h>
+#include "ns3/header.h"
+
+namespace ns3 {
+
+/**
+ * \ingroup tcp
+ * \brief Header of a QTCP message (QED or SEND)
+ *
+ * Every message that the application writes in a QTCP socket is carried by
+ * two records in the TCP stream, a QED and a SEND, each one made of this
+ * header, the payload and the redundancy. The header layout is:
+ *
+ * \verbatim
+    0                   1                   2                   3
+    0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+   |      'Q'      |      'T'      |      'C'      |      'S'      |
+   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+   |        QED: esQseq               SEND: stageQseq              |
+   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+   |        QED: stageQseq            SEND: sendQseq               |
+   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+   |1|S|  HdrLen   |  Redundancy   |        Payload length         |
+   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+   |                    Padding (HdrLen * 4 - 16)                  |
+   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+   \endverbatim
+ *
+ * S is set for a SEND message. HdrLen is the header length in 32-bit words,
+ * so the header length must be a multiple of 4 bytes, between 16 and 252.
+ * Redundancy and payload length are in bytes.
+ */
+class QtcpHeader : public Header
+{
+public:
+  /**
+   * \brief QTCP message types
+   */
+  typedef enum
+  {
+    QED = 0,  //!< Entanglement distribution record
+    SEND = 1  //!< Data record
+  } MessageType_t;
+
+  static const uint16_t MIN_LENGTH = 16;  //!< Length of the header without padding
+  static const uint16_t MAX_LENGTH = 252; //!< Longest header that HdrLen can describe
+
+  QtcpHeader ();
+  virtual ~QtcpHeader ();
+
+  /**
+   * \brief Get the type ID.
+   * \return the object TypeId
+   */
+  static TypeId GetTypeId (void);
+  virtual TypeId GetInstanceTypeId (void) const;
+  virtual void Print (std::ostream &os) const;
+  virtual uint32_t GetSerializedSize (void) const;
+  virtual void Serialize (Buffer::Iterator start) const;
+  virtual uint32_t Deserialize (Buffer::Iterator start);
+
+  /**
+   * \brief Set the message type
+   * \param type QED or SEND
+   */
+  void SetMessageType (MessageType_t type);
+
+  /**
+   * \brief Get the message type
+   * \return QED or SEND
+   */
+  MessageType_t GetMessageType (void) const;
+
+  /**
+   * \brief Set the entanglement sequence number (QED only)
+   * \param seq the sequence number
+   */
+  void SetEsQseq (uint32_t seq);
+
+  /**
+   * \brief Get the entanglement sequence number (QED only)
+   * \return the sequence number
+   */
+  uint32_t GetEsQseq (void) const;
+
+  /**
+   * \brief Set the stage sequence number
+   * \param seq the sequence number
+   */
+  void SetStageQseq (uint32_t seq);
+
+  /**
+   * \brief Get the stage sequence number
+   * \return the sequence number
+   */
+  uint32_t GetStageQseq (void) const;
+
+  /**
+   * \brief Set the SEND sequence number (SEND only)
+   * \param seq the sequence number
+   */
+  void SetSendQseq (uint32_t seq);
+
+  /**
+   * \brief Get the SEND sequence number (SEND only)
+   * \return the sequence number
+   */
+  uint32_t GetSendQseq (void) const;
+
+  /**
+   * \brief Set the header length, padding included
+   * \param length the length in bytes (multiple of 4, in [16, 252])
+   */
+  void SetHeaderLength (uint16_t length);
+
+  /**
+   * \brief Get the header length, padding included
+   * \return the length in bytes
+   */
+  uint16_t GetHeaderLength (void) const;
+
+  /**
+   * \brief Set the length of the redundancy that follows the payload
+   * \param length the length in bytes
+   */
+  void SetRedundancyLength (uint8_t length);
+
+  /**
+   * \brief Get the length of the redundancy that follows the payload
+   * \return the length in bytes
+   */
+  uint8_t GetRedundancyLength (void) const;
+
+  /**
+   * \brief Set the length of the payload that follows the header
+   * \param length the length in bytes
+   */
+  void SetPayloadLength (uint16_t length);
+
+  /**
+   * \brief Get the length of the payload that follows the header
+   * \return the length in bytes
+   */
+  uint16_t GetPayloadLength (void) const;
+
+  /**
+   * \brief Get the length of the whole record (header, payload, redundancy)
+   * \return the length in bytes
+   */
+  uint32_t GetRecordLength (void) const;
+
+  /**
+   * \brief Check if the last deserialized bytes were a QTCP header
+   * \return true if the magic and the type marker were found
+   */
+  bool IsValid (void) const;
+
+  /**
+   * \brief Read the header length from the first MIN_LENGTH bytes of a
+   * serialized header, before the whole header is available
+   * \param fixed the first MIN_LENGTH bytes of the header
+   * \return the header length in bytes, or 0 if fixed is not a QTCP header
+   */
+  static uint16_t PeekHeaderLength (const uint8_t *fixed);
+
+private:
+  MessageType_t m_type;     //!< Message type
+  uint32_t m_esQseq;        //!< Entanglement sequence number (QED)
+  uint32_t m_stageQseq;     //!< Stage sequence number
+  uint32_t m_sendQseq;      //!< SEND sequence number (SEND)
+  uint16_t m_length;        //!< Header length in bytes
+  uint8_t m_redundancy;     //!< Redundancy length in bytes
+  uint16_t m_payload;       //!< Payload length in bytes
+  bool m_valid;             //!< Magic found while deserializing
+};
+
+} // namespace ns3
+
+#endif /* QTCP_HEADER_H */
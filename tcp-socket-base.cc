@@ -40,6 +40,7 @@
 #include "ns3/uinteger.h"
 #include "ns3/double.h"
 #include "ns3/pointer.h"
+#include "ns3/enum.h"
 #include "ns3/trace-source-accessor.h"
 #include "tcp-socket-base.h"
 #include "tcp-l4-protocol.h"
@@ -129,12 +130,87 @@ TcpSocketBase::GetTypeId (void)
                    MakePointerChecker<TcpRxBuffer> ())
     .AddAttribute ("ReTxThreshold", "Threshold for fast retransmit",
                    UintegerValue (3),
-                   MakeUintegerAccessor (&TcpSocketBase::m_retxThresh),
+                   MakeUintegerAccessor (&TcpSocketBase::SetRetxThresh,
+                                         &TcpSocketBase::GetRetxThresh),
                    MakeUintegerChecker<uint32_t> ())
     .AddAttribute ("LimitedTransmit", "Enable limited transmit",
                    BooleanValue (true),
                    MakeBooleanAccessor (&TcpSocketBase::m_limitedTx),
                    MakeBooleanChecker ())
+    .AddAttribute ("QtcpDecoding",
+                   "Parse the received QTCP records and give only the payload "
+                   "of the SEND records to the application",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&TcpSocketBase::m_qtcpDecoding),
+                   MakeBooleanChecker ())
+    .AddAttribute ("QedLossPolicy",
+                   "Recovery of the lost QED records: regenerate them in place, "
+                   "resend them unchanged, or resend them unchanged after the "
+                   "lost SEND records",
+                   EnumValue (TcpTxBuffer::QED_REGENERATE),
+                   MakeEnumAccessor (&TcpSocketBase::SetQedLossPolicy,
+                                     &TcpSocketBase::GetQedLossPolicy),
+                   MakeEnumChecker (TcpTxBuffer::QED_REGENERATE, "Regenerate",
+                                    TcpTxBuffer::QED_RESEND, "Resend",
+                                    TcpTxBuffer::QED_SEND_FIRST, "SendFirst"))
+    .AddAttribute ("QedRetries",
+                   "Number of RTO retransmissions of a QED at the head of the "
+                   "window before the connection is dropped; 0 counts them "
+                   "against DataRetries",
+                   UintegerValue (0),
+                   MakeUintegerAccessor (&TcpSocketBase::m_qedRetries),
+                   MakeUintegerChecker<uint32_t> ())
+    .AddAttribute ("AdaptiveRedundancy",
+                   "Adapt the redundancy length of the QTCP messages "
+                   "(TcpTxBuffer::REDSIZE) to the losses seen by the socket",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&TcpSocketBase::m_adaptiveRed),
+                   MakeBooleanChecker ())
+    .AddAttribute ("MinRedundancy",
+                   "Lowest redundancy length (bytes) with AdaptiveRedundancy",
+                   UintegerValue (0),
+                   MakeUintegerAccessor (&TcpSocketBase::m_minRed),
+                   MakeUintegerChecker<uint8_t> ())
+    .AddAttribute ("MaxRedundancy",
+                   "Highest redundancy length (bytes) with AdaptiveRedundancy",
+                   UintegerValue (48),
+                   MakeUintegerAccessor (&TcpSocketBase::m_maxRed),
+                   MakeUintegerChecker<uint8_t> ())
+    .AddAttribute ("RedundancyStep",
+                   "Change of the redundancy length (bytes) on a loss, or "
+                   "after a window acknowledged without loss",
+                   UintegerValue (8),
+                   MakeUintegerAccessor (&TcpSocketBase::m_redStep),
+                   MakeUintegerChecker<uint8_t> ())
+    .AddAttribute ("PacingMode",
+                   "Where the packets are paced: in TCP, in the application "
+                   "only, or nowhere (default from PACING_CONFIG)",
+                   EnumValue (PACING_CONFIG),
+                   MakeEnumAccessor (&TcpSocketBase::m_pacingMode),
+                   MakeEnumChecker (TCP_PACING, "TcpPacing",
+                                    APP_PACING, "AppPacing",
+                                    NO_PACING, "NoPacing"))
+    .AddAttribute ("PacingBurst",
+                   "Maximum number of segments sent per pacing timer event "
+                   "with TcpPacing; the interval grows with the burst, so the "
+                   "average rate does not change",
+                   UintegerValue (1),
+                   MakeUintegerAccessor (&TcpSocketBase::m_pacingBurst),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("BatchedTransmit",
+                   "Build the headers of the segments sent by one "
+                   "SendPendingData call from one template, and give them to "
+                   "TcpL4Protocol together after the window is filled",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&TcpSocketBase::m_batchedTx),
+                   MakeBooleanChecker ())
+    .AddAttribute ("CoalesceDataSent",
+                   "Notify the application once per burst of segments (one "
+                   "SendPendingData call, or one pacing event) with the new "
+                   "bytes of the whole burst, instead of once per segment",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&TcpSocketBase::m_coalesceSent),
+                   MakeBooleanChecker ())
     .AddTraceSource ("RTO",
                      "Retransmission timeout",
                      MakeTraceSourceAccessor (&TcpSocketBase::m_rto),
@@ -187,6 +263,10 @@ TcpSocketBase::GetTypeId (void)
                      "TCP slow start threshold (bytes)",
                      MakeTraceSourceAccessor (&TcpSocketBase::m_ssThTrace),
                      "ns3::TracedValueCallback::Uint32")
+    .AddTraceSource ("Redundancy",
+                     "Redundancy length chosen with AdaptiveRedundancy",
+                     MakeTraceSourceAccessor (&TcpSocketBase::m_redundancy),
+                     "ns3::TracedValueCallback::Uint32")
     .AddTraceSource ("Tx",
                      "Send tcp packet to IP protocol",
                      MakeTraceSourceAccessor (&TcpSocketBase::m_txTrace),
@@ -251,6 +331,7 @@ TcpSocketState::TcpSocketState (void)
     m_nextTxSequence (0),
     m_rcvTimestampValue (0),
     m_rcvTimestampEchoReply (0),
+    m_pacedInFlight (0),
     m_pacing_rate (0.0) // For pacing
 {
 }
@@ -268,6 +349,7 @@ TcpSocketState::TcpSocketState (const TcpSocketState &other)
     m_nextTxSequence (other.m_nextTxSequence),
     m_rcvTimestampValue (other.m_rcvTimestampValue),
     m_rcvTimestampEchoReply (other.m_rcvTimestampEchoReply),
+    m_pacedInFlight (other.m_pacedInFlight),
     m_pacing_rate (other.m_pacing_rate) // For pacing
 {
 }
@@ -282,6 +364,9 @@ TcpSocketBase::TcpSocketBase (void)
   : TcpSocket (),
     m_pacing_event (),   // For pacing
     m_pacing_packets (), // For pacing
+    m_pacing_bytes (0),  // For pacing
+    m_pacingMode (PACING_CONFIG), // For pacing
+    m_pacingBurst (1),   // For pacing
     m_retxEvent (),
     m_lastAckEvent (),
     m_delAckEvent (),
@@ -295,6 +380,8 @@ TcpSocketBase::TcpSocketBase (void)
     m_synRetries (0),
     m_dataRetrCount (0),
     m_dataRetries (0),
+    m_qedRetrCount (0),
+    m_qedRetries (0),
     m_rto (Seconds (0.0)),
     m_minRto (Time::Max ()),
     m_clockGranularity (Seconds (0.001)),
@@ -336,15 +423,22 @@ TcpSocketBase::TcpSocketBase (void)
     m_retxThresh (3),
     m_limitedTx (false),
     m_congestionControl (0),
-    m_isFirstPartialAck (true)
+    m_isFirstPartialAck (true),
+    m_qtcpDecoding (false),
+    m_adaptiveRed (false),
+    m_minRed (0),
+    m_maxRed (0),
+    m_redStep (0),
+    m_redCleanBytes (0),
+    m_redundancy (0),
+    m_batchedTx (false),
+    m_txBatching (false),
+    m_coalesceSent (false),
+    m_sentBurst (false),
+    m_sentBurstBytes (0)
 {
   NS_LOG_FUNCTION (this);
 
-  if (PACING_CONFIG == TCP_PACING) 
-    NS_LOG_INFO ("PACING_IN_TCP - Pacing in TCP is enabled.");
-  else
-    NS_LOG_INFO ("APP_PACING/NO_PACING - Pacing in TCP is *not* enabled.");
-
   m_rxBuffer = CreateObject<TcpRxBuffer> ();
   m_txBuffer = CreateObject<TcpTxBuffer> ();
   m_tcb      = CreateObject<TcpSocketState> ();
@@ -376,6 +470,9 @@ TcpSocketBase::TcpSocketBase (const TcpSocketBase& sock)
   : TcpSocket (sock),
     m_pacing_event (sock.m_pacing_event),     // For pacing
     m_pacing_packets (sock.m_pacing_packets), // For pacing
+    m_pacing_bytes (sock.m_pacing_bytes),     // For pacing
+    m_pacingMode (sock.m_pacingMode),         // For pacing
+    m_pacingBurst (sock.m_pacingBurst),       // For pacing
     //copy object::m_tid and socket::callbacks
     m_dupAckCount (sock.m_dupAckCount),
     m_delAckCount (0),
@@ -385,6 +482,8 @@ TcpSocketBase::TcpSocketBase (const TcpSocketBase& sock)
     m_synRetries (sock.m_synRetries),
     m_dataRetrCount (sock.m_dataRetrCount),
     m_dataRetries (sock.m_dataRetries),
+    m_qedRetrCount (sock.m_qedRetrCount),
+    m_qedRetries (sock.m_qedRetries),
     m_rto (sock.m_rto),
     m_minRto (sock.m_minRto),
     m_clockGranularity (sock.m_clockGranularity),
@@ -420,6 +519,18 @@ TcpSocketBase::TcpSocketBase (const TcpSocketBase& sock)
     m_retxThresh (sock.m_retxThresh),
     m_limitedTx (sock.m_limitedTx),
     m_isFirstPartialAck (sock.m_isFirstPartialAck),
+    m_qtcpDecoding (sock.m_qtcpDecoding),
+    m_adaptiveRed (sock.m_adaptiveRed),
+    m_minRed (sock.m_minRed),
+    m_maxRed (sock.m_maxRed),
+    m_redStep (sock.m_redStep),
+    m_redCleanBytes (0),
+    m_redundancy (sock.m_redundancy),
+    m_batchedTx (sock.m_batchedTx),
+    m_txBatching (false),
+    m_coalesceSent (sock.m_coalesceSent),
+    m_sentBurst (false),
+    m_sentBurstBytes (0),
     m_txTrace (sock.m_txTrace),
     m_rxTrace (sock.m_rxTrace)
 {
@@ -748,6 +859,7 @@ TcpSocketBase::Connect (const Address & address)
   m_rtt->Reset ();
   m_synCount = m_synRetries;
   m_dataRetrCount = m_dataRetries;
+  m_qedRetrCount = m_qedRetries;
 
   // DoConnect() will do state-checking and send a SYN packet
   return DoConnect ();
@@ -864,16 +976,7 @@ TcpSocketBase::Send (Ptr<Packet> p, uint32_t flags)
         }
       // Submit the data to lower layers
       NS_LOG_LOGIC ("txBufSize=" << m_txBuffer->Size () << " state " << TcpStateName[m_state]);
-      if ((m_state == ESTABLISHED || m_state == CLOSE_WAIT) && AvailableWindow () > 0)
-        { // Try to send the data out: Add a little step to allow the application
-          // to fill the buffer
-          if (!m_sendPendingDataEvent.IsRunning ())
-            {
-              m_sendPendingDataEvent = Simulator::Schedule (TimeStep (1),
-                                                            &TcpSocketBase::SendPendingData,
-                                                            this, m_connected);
-            }
-        }
+      ScheduleSendPendingData ();
       return p->GetSize ();
     }
   else
@@ -883,6 +986,59 @@ TcpSocketBase::Send (Ptr<Packet> p, uint32_t flags)
     }
 }
 
+int
+TcpSocketBase::SendBatch (const std::vector<Ptr<Packet> > &packets, uint32_t flags)
+{
+  NS_LOG_FUNCTION (this << packets.size ());
+  NS_ABORT_MSG_IF (flags, "use of flags is not supported in TcpSocketBase::SendBatch()");
+  if (m_state == ESTABLISHED || m_state == SYN_SENT || m_state == CLOSE_WAIT)
+    {
+      // Store the packets into Tx buffer
+      uint32_t admitted = m_txBuffer->AddBatch (packets);
+      if (admitted == 0 && !packets.empty ())
+        { // TxBuffer overflow, send failed
+          m_errno = ERROR_MSGSIZE;
+          return -1;
+        }
+      if (m_shutdownSend)
+        {
+          m_errno = ERROR_SHUTDOWN;
+          return -1;
+        }
+      // Submit the data to lower layers, once for the whole batch
+      NS_LOG_LOGIC ("txBufSize=" << m_txBuffer->Size () << " state " << TcpStateName[m_state] <<
+                    " queued " << admitted << "/" << packets.size ());
+      ScheduleSendPendingData ();
+
+      uint32_t bytes = 0;
+      for (uint32_t i = 0; i < admitted; ++i)
+        {
+          bytes += packets[i]->GetSize ();
+        }
+      return bytes;
+    }
+  else
+    { // Connection not established yet
+      m_errno = ERROR_NOTCONN;
+      return -1; // Send failure
+    }
+}
+
+void
+TcpSocketBase::ScheduleSendPendingData (void)
+{
+  if ((m_state == ESTABLISHED || m_state == CLOSE_WAIT) && AvailableWindow () > 0)
+    { // Try to send the data out: Add a little step to allow the application
+      // to fill the buffer
+      if (!m_sendPendingDataEvent.IsRunning ())
+        {
+          m_sendPendingDataEvent = Simulator::Schedule (TimeStep (1),
+                                                        &TcpSocketBase::SendPendingData,
+                                                        this, m_connected);
+        }
+    }
+}
+
 /* Inherit from Socket class: In TcpSocketBase, it is same as Send() call */
 int
 TcpSocketBase::SendTo (Ptr<Packet> p, uint32_t flags, const Address &address)
@@ -897,6 +1053,10 @@ TcpSocketBase::Recv (uint32_t maxSize, uint32_t flags)
 {
   NS_LOG_FUNCTION (this);
   NS_ABORT_MSG_IF (flags, "use of flags is not supported in TcpSocketBase::Recv()");
+  if (m_qtcpDecoding)
+    {
+      return RecvPayload (maxSize);
+    }
   if (m_rxBuffer->Size () == 0 && m_state == CLOSE_WAIT)
     {
       return Create<Packet> (); // Send EOF on connection close
@@ -908,6 +1068,36 @@ return outPacket;
   
 }
 
+Ptr<Packet>
+TcpSocketBase::RecvPayload (uint32_t maxSize)
+{
+  NS_LOG_FUNCTION (this << maxSize);
+
+  FillDecoder ();
+  Ptr<Packet> payload = m_qtcpDecoder.Pop (maxSize);
+  // Get the next SEND ready, for GetRxAvailable
+  FillDecoder ();
+
+  if (payload == 0 && m_rxBuffer->Size () == 0 && m_state == CLOSE_WAIT)
+    {
+      return Create<Packet> (); // Send EOF on connection close
+    }
+  return payload;
+}
+
+void
+TcpSocketBase::FillDecoder (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  // Move the in-order bytes into the decoder only until it has a complete
+  // SEND record: the rest stays in the Rx buffer, and in the window
+  while (m_qtcpDecoder.Decode () == 0 && m_rxBuffer->Available () > 0)
+    {
+      m_qtcpDecoder.Push (m_rxBuffer->Extract (m_tcb->m_segmentSize));
+    }
+}
+
 /* Inherit from Socket class: Recv and return the remote's address */
 Ptr<Packet>
 TcpSocketBase::RecvFrom (uint32_t maxSize, uint32_t flags, Address &fromAddress)
@@ -929,34 +1119,7 @@ TcpSocketBase::RecvFrom (uint32_t maxSize, uint32_t flags, Address &fromAddress)
         {
           fromAddress = InetSocketAddress (Ipv4Address::GetZero (), 0);
         }
-
-/*
-uint32_t packnum;
-
-packnum=packet->GetSize ();
-
-uint8_t bbb[packnum];
-packet->CopyData(bbb,packnum);
-if(bbb[0]=='A' && bbb[1]=='P' && bbb[2]=='P')
-{
-//packet->RemoveAtEnd(packnum);
-packet->RemoveAtEnd(24);// clear APP head 12
-packet->RemoveAtStart(12);//clear APP end 24
-}
-
- if(bbb[0]=='Q' && bbb[1]=='I' && bbb[2]=='D')
-{
-//packet->RemoveAtStart(12);
-packet->RemoveAtEnd(packnum);//clear QID
-//return Create<Packet> ();
-}
-*/
-
     }
-
-
-
-
   return packet;
 }
 
@@ -973,6 +1136,11 @@ uint32_t
 TcpSocketBase::GetRxAvailable (void) const
 {
   NS_LOG_FUNCTION (this);
+  if (m_qtcpDecoding)
+    {
+      // Only the SEND payload is readable; FillDecoder keeps it ready
+      return m_qtcpDecoder.GetAvailable ();
+    }
   return m_rxBuffer->Available ();
 }
 
@@ -1056,6 +1224,13 @@ TcpSocketBase::SetupCallback (void)
     {
       return -1;
     }
+
+  // The attributes are set by now, unlike in the constructor
+  if (GetPacingMode () == TCP_PACING)
+    NS_LOG_INFO ("PACING_IN_TCP - Pacing in TCP is enabled (PacingMode).");
+  else
+    NS_LOG_INFO ("APP_PACING/NO_PACING - Pacing in TCP is *not* enabled (PacingMode).");
+
   if (m_endPoint != 0)
     {
       m_endPoint->SetRxCallback (MakeCallback (&TcpSocketBase::ForwardUp, Ptr<TcpSocketBase> (this)));
@@ -1081,6 +1256,7 @@ TcpSocketBase::DoConnect (void)
   // A new connection is allowed only if this socket does not have a connection
   if (m_state == CLOSED || m_state == LISTEN || m_state == SYN_SENT || m_state == LAST_ACK || m_state == CLOSE_WAIT)
     { // send a SYN packet and change state into SYN_SENT
+      InitRedundancy ();
       SendEmptyPacket (TcpHeader::SYN);
       NS_LOG_DEBUG (TcpStateName[m_state] << " -> SYN_SENT");
       m_state = SYN_SENT;
@@ -1272,6 +1448,10 @@ TcpSocketBase::DoForwardUp (Ptr<Packet> packet, const Address &fromAddress,
 
   m_rxTrace (packet, tcpHeader, this);
 
+  // Read once the options used by ReadOptions and EstimateRtt; ReceivedAck
+  // finds them in m_rxOptions
+  ReadAckOptions (tcpHeader, m_rxOptions);
+
   if (tcpHeader.GetFlags () & TcpHeader::SYN)
     {
       /* The window field in a segment where the SYN bit is set (i.e., a <SYN>
@@ -1299,10 +1479,9 @@ TcpSocketBase::DoForwardUp (Ptr<Packet> packet, const Address &fromAddress,
         }
 
       // When receiving a <SYN> or <SYN-ACK> we should adapt TS to the other end
-      if (tcpHeader.HasOption (TcpOption::TS) && m_timestampEnabled)
+      if (m_rxOptions.ts && m_timestampEnabled)
         {
-          ProcessOptionTimestamp (tcpHeader.GetOption (TcpOption::TS),
-                                  tcpHeader.GetSequenceNumber ());
+          ProcessOptionTimestamp (m_rxOptions.ts, tcpHeader.GetSequenceNumber ());
         }
       else
         {
@@ -1315,7 +1494,7 @@ TcpSocketBase::DoForwardUp (Ptr<Packet> packet, const Address &fromAddress,
 
       if (tcpHeader.GetFlags () & TcpHeader::ACK)
         {
-          EstimateRtt (tcpHeader);
+          EstimateRtt (tcpHeader, m_rxOptions);
           m_highRxAckMark = tcpHeader.GetAckNumber ();
         }
     }
@@ -1324,7 +1503,7 @@ TcpSocketBase::DoForwardUp (Ptr<Packet> packet, const Address &fromAddress,
       NS_ASSERT (!(tcpHeader.GetFlags () & TcpHeader::SYN));
       if (m_timestampEnabled)
         {
-          if (!tcpHeader.HasOption (TcpOption::TS))
+          if (!m_rxOptions.ts)
             {
               // Ignoring segment without TS, RFC 7323
               NS_LOG_LOGIC ("At state " << TcpStateName[m_state] <<
@@ -1335,12 +1514,11 @@ TcpSocketBase::DoForwardUp (Ptr<Packet> packet, const Address &fromAddress,
             }
           else
             {
-              ProcessOptionTimestamp (tcpHeader.GetOption (TcpOption::TS),
-                                      tcpHeader.GetSequenceNumber ());
+              ProcessOptionTimestamp (m_rxOptions.ts, tcpHeader.GetSequenceNumber ());
             }
         }
 
-      EstimateRtt (tcpHeader);
+      EstimateRtt (tcpHeader, m_rxOptions);
       UpdateWindowSize (tcpHeader);
     }
 
@@ -1510,24 +1688,38 @@ TcpSocketBase::IsTcpOptionEnabled (uint8_t kind) const
 }
 
 void
-TcpSocketBase::ReadOptions (const TcpHeader &tcpHeader, bool &scoreboardUpdated)
+TcpSocketBase::ReadOptions (const TcpAckOptions &options, bool &scoreboardUpdated)
 {
-  NS_LOG_FUNCTION (this << tcpHeader);
-  TcpHeader::TcpOptionList::const_iterator it;
-  const TcpHeader::TcpOptionList options = tcpHeader.GetOptionList ();
+  NS_LOG_FUNCTION (this);
 
-  for (it = options.begin (); it != options.end (); ++it)
+  // Check only for ACK options here
+  if (options.sack)
     {
-      const Ptr<const TcpOption> option = (*it);
+      scoreboardUpdated = ProcessOptionSack (options.sack);
+    }
+}
+
+void
+TcpSocketBase::ReadAckOptions (const TcpHeader &tcpHeader, TcpAckOptions &options) const
+{
+  NS_LOG_FUNCTION (this << tcpHeader);
+  options.sack = 0;
+  options.ts = 0;
 
-      // Check only for ACK options here
-      switch (option->GetKind ())
+  // The list is walked in place: the kind tells the type of the option
+  const TcpHeader::TcpOptionList &list = tcpHeader.GetOptionList ();
+  for (TcpHeader::TcpOptionList::const_iterator it = list.begin (); it != list.end (); ++it)
+    {
+      switch ((*it)->GetKind ())
         {
         case TcpOption::SACK:
-          scoreboardUpdated = ProcessOptionSack (option);
+          options.sack = StaticCast<const TcpOptionSack> (*it);
+          break;
+        case TcpOption::TS:
+          options.ts = StaticCast<const TcpOptionTS> (*it);
           break;
         default:
-          continue;
+          break;
         }
     }
 }
@@ -1592,6 +1784,8 @@ TcpSocketBase::EnterRecovery ()
                "Reset cwnd to " << m_tcb->m_cWnd << ", ssthresh to " <<
                m_tcb->m_ssThresh << " at fast recovery seqnum " << m_recover);
 
+  AdaptRedundancy (true);
+
   // (4.3) Retransmit the first data segment presumed dropped
   DoRetransmit ();
   // (4.4) Run SetPipe ()
@@ -1599,6 +1793,48 @@ TcpSocketBase::EnterRecovery ()
   // the step C is done after the ProcessAck function (SendPendingData)
 }
 
+void
+TcpSocketBase::AdaptRedundancy (bool loss)
+{
+  NS_LOG_FUNCTION (this << loss);
+  m_redCleanBytes = 0;
+  if (!m_adaptiveRed)
+    {
+      return;
+    }
+
+  uint32_t red = m_txBuffer->GetRedundancy ();
+  if (loss)
+    {
+      // Each retransmission of the same head since the last new ACK means
+      // the loss is heavier
+      uint32_t steps = 1 + SafeSubtraction (m_dataRetries, m_dataRetrCount);
+      red = std::min<uint32_t> (red + steps * m_redStep, m_maxRed);
+    }
+  else
+    {
+      red = std::max<uint32_t> (SafeSubtraction (red, m_redStep), m_minRed);
+    }
+
+  if (red != m_txBuffer->GetRedundancy ())
+    {
+      NS_LOG_DEBUG ("Redundancy " << static_cast<uint32_t> (m_txBuffer->GetRedundancy ()) <<
+                    " -> " << red << (loss ? " after a loss" : " after a clean window"));
+      m_txBuffer->SetRedundancy (red);
+    }
+  m_redundancy = red;
+}
+
+void
+TcpSocketBase::InitRedundancy (void)
+{
+  NS_LOG_FUNCTION (this);
+  NS_ABORT_MSG_IF (m_adaptiveRed && m_minRed > m_maxRed,
+                   "MinRedundancy (" << static_cast<uint32_t> (m_minRed) <<
+                   ") is above MaxRedundancy (" << static_cast<uint32_t> (m_maxRed) << ")");
+  m_redundancy = m_txBuffer->GetRedundancy ();
+}
+
 void
 TcpSocketBase::DupAck ()
 {
@@ -1685,7 +1921,7 @@ TcpSocketBase::ReceivedAck (Ptr<Packet> packet, const TcpHeader& tcpHeader)
   // Upon the receipt of any ACK containing SACK information, the
   // scoreboard MUST be updated via the Update () routine (done in ReadOptions)
   bool scoreboardUpdated = false;
-  ReadOptions (tcpHeader, scoreboardUpdated);
+  ReadOptions (m_rxOptions, scoreboardUpdated);
 
   SequenceNumber32 ackNumber = tcpHeader.GetAckNumber ();
 
@@ -2197,6 +2433,10 @@ TcpSocketBase::ProcessWait (Ptr<Packet> packet, const TcpHeader& tcpHeader)
       SendEmptyPacket (TcpHeader::ACK);
       if (!m_shutdownRecv)
         {
+          if (m_qtcpDecoding)
+            {
+              FillDecoder ();
+            }
           NotifyDataRecv ();
         }
     }
@@ -2667,7 +2907,9 @@ TcpSocketBase::CompleteFork (Ptr<Packet> p, const TcpHeader& h,
   m_state = SYN_RCVD;
   m_synCount = m_synRetries;
   m_dataRetrCount = m_dataRetries;
+  m_qedRetrCount = m_qedRetries;
   SetupCallback ();
+  InitRedundancy ();
   // Set the sequence number and send SYN+ACK
   m_rxBuffer->SetNextRxSequence (h.GetSequenceNumber () + SequenceNumber32 (1));
 
@@ -2697,19 +2939,14 @@ TcpSocketBase::SendDataPacket (SequenceNumber32 seq, uint32_t maxSize, bool with
   NS_LOG_FUNCTION (this << seq << maxSize << withAck);
 
   // If not TCP pacing, go ahead and send normally.
-  if (PACING_CONFIG == NO_PACING || PACING_CONFIG == APP_PACING)
+  if (m_pacingMode == NO_PACING || m_pacingMode == APP_PACING)
     return SendDataPacketReal(seq, maxSize, withAck);
 
-         if (m_txBuffer->qidnum()==0&&m_txBuffer->QidSize()>=0&&m_txBuffer->QidSize()==m_txBuffer->QidsentSize()&&m_txBuffer->Size()>0)
-        {
-          NS_LOG_INFO ("qidsize==qidsentSize;1 no data to transmit");
-        return SendDataPacketReal(seq, maxSize, withAck);
-        }
-    if (m_txBuffer->qidnum()==0&&m_txBuffer->AppSize()>=0&&m_txBuffer->AppSize()==m_txBuffer->AppsentSize()&&m_txBuffer->Size()>0)
-        {
-          NS_LOG_INFO ("appsize==appsentSize;1 no data to transmit");
-        return SendDataPacketReal(seq, maxSize, withAck);
-        }
+  if (m_txBuffer->IsWaitingForEntanglement ())
+    {
+      NS_LOG_INFO ("Waiting for an entanglement;1 not paced");
+      return SendDataPacketReal(seq, maxSize, withAck);
+    }
 
   // Pacing, so queue until time to send else send now.
   // pacing_rate: pacing rate for flow, controls inter-packet spacing.
@@ -2720,9 +2957,15 @@ TcpSocketBase::SendDataPacket (SequenceNumber32 seq, uint32_t maxSize, bool with
   } else {
     NS_LOG_LOGIC (this << " Pacing rate: " << pacing_rate);
 
+    // Reserve the block now, so the size is known, and build the packet
+    // only when it is paced out.
+    uint32_t sz = m_txBuffer->Reserve(maxSize, seq);
+    if (sz == 0)
+      return 0;
+
     // Store packet.
-    tcp_pacing_struct packet{seq, maxSize, withAck};
-    m_pacing_packets.push(packet);
+    tcp_pacing_struct packet{seq, maxSize, withAck, sz};
+    PushPacing(packet);
 
     NS_LOG_LOGIC (this << " Storing: " <<
                  packet.seq << " " << 
@@ -2735,33 +2978,32 @@ TcpSocketBase::SendDataPacket (SequenceNumber32 seq, uint32_t maxSize, bool with
       NS_LOG_LOGIC (this << " Previous event expired. Scheduling immediately. event_id: " << m_pacing_event.GetUid() << "  timestamp: " << m_pacing_event.GetTs()/1000000000.0);
     }
 
-    // Return size that would have been sent so app knows it's scheduled.
-    Ptr<Packet> p = m_txBuffer->CopyFromSequence(maxSize, seq);
-    uint32_t sz = p->GetSize(); // Size of packet
     return sz;
   }
 }
 
-// Send next packet in queue and set timer for subsequent send.
+// Send next packets in queue (up to PacingBurst) and set timer for
+// subsequent send.
 void TcpSocketBase::PacePackets () {
-  double size;
   NS_LOG_FUNCTION (this);
   if(m_state==FIN_WAIT_1) return;
   if(m_state==FIN_WAIT_2) return;
-  //if(m_pacing_packets.size()==0){ DoRetransmit (); return;}
-  // If pacing queue empty, app hasn't provided more data.
- 
-  NS_LOG_INFO ("111"<<this << " Pacing packets: " << m_pacing_packets.size());
+
+  // If pacing queue empty, app hasn't provided more data. Stop ticking: the
+  // next queued packet restarts the timer (see SendDataPacket).
+  NS_LOG_INFO (this << " Pacing packets: " << m_pacing_packets.size());
   if (m_pacing_packets.empty()) {
     NS_LOG_LOGIC (this << " Pacing list empty.");
-    size = 576; // Temporary packet bytes for computing pacing interval.  //1000
-NS_LOG_INFO ("222"<<this << " Pacing packets: " << m_pacing_packets.size());
-
-  } else {
+    return;
+  }
 
+  // Send a burst, and get its size for computing pacing interval.
+  uint64_t size = 0;
+  if (m_coalesceSent)
+    BeginSentBurst();
+  for (uint32_t i = 0; i < std::max<uint32_t> (m_pacingBurst, 1) && !m_pacing_packets.empty(); ++i) {
     // Get next packet to send.
-    tcp_pacing_struct packet = m_pacing_packets.front();
-    m_pacing_packets.pop();
+    tcp_pacing_struct packet = PopPacing();
 
     NS_LOG_LOGIC (this << " Sending real: " <<
                  packet.seq << " " << 
@@ -2769,28 +3011,28 @@ NS_LOG_INFO ("222"<<this << " Pacing packets: " << m_pacing_packets.size());
                  packet.withAck);
 
     // Send it.
-    SendDataPacketReal(packet.seq, packet.maxSize, packet.withAck);
-NS_LOG_INFO ("333"<<this << " Pacing packets: " << m_pacing_packets.size());
-    // Get size for computing pacing interval.
-    size = packet.maxSize;
+    SendDataPacketReal(packet.seq, packet.maxSize, packet.withAck, packet.size);
+    size += packet.size;
   }
+  if (m_sentBurst)
+    EndSentBurst();
 
   // Schedule next send event.
   double pacing_rate = m_tcb -> GetPacingRate();
 
   if (pacing_rate >0) {
-    size *= 8 / 1000000.0;  // Convert to Mbits.
-    double delta = size / pacing_rate; // Convert to seconds.
-    delta *= 1000000000;  // Convert to nanoseconds.
+    // Interval in whole nanoseconds: bits * 1e9 / (bits per second).
+    uint64_t rate_bps = static_cast<uint64_t> (pacing_rate * 1000000.0);
+    uint64_t delta = rate_bps > 0 ? size * 8 * 1000000000ULL / rate_bps : 0;
     m_pacing_event.Cancel();  // Cancel any pending events. Needed?
-    m_pacing_event = Simulator::Schedule(Time(delta),
+    m_pacing_event = Simulator::Schedule(NanoSeconds(delta),
                                         &TcpSocketBase::PacePackets, this);
     NS_LOG_LOGIC (this <<
                  " event_id: " << m_pacing_event.GetUid() <<
-                 "  size: " << size/8*1000000 <<
+                 "  size: " << size <<
                  "  rate: " << pacing_rate <<
-                 "  delta: " << delta/1000000000 <<
-                 "  @time: " << Time(Simulator::Now()+delta).GetSeconds());
+                 "  delta: " << NanoSeconds(delta).GetSeconds() <<
+                 "  @time: " << (Simulator::Now() + NanoSeconds(delta)).GetSeconds());
   } else
     NS_LOG_LOGIC (this << " rate: " << pacing_rate << " (no pacing)");  
 }
@@ -2799,9 +3041,10 @@ NS_LOG_INFO ("333"<<this << " Pacing packets: " << m_pacing_packets.size());
    Extract at most maxSize bytes from the TxBuffer at sequence seq, add the
    TCP header, and send to TcpL4Protocol */
 uint32_t
-TcpSocketBase::SendDataPacketReal (SequenceNumber32 seq, uint32_t maxSize, bool withAck)
+TcpSocketBase::SendDataPacketReal (SequenceNumber32 seq, uint32_t maxSize, bool withAck,
+                                   uint32_t reserved)
 {
-  NS_LOG_FUNCTION (this << seq << maxSize << withAck);
+  NS_LOG_FUNCTION (this << seq << maxSize << withAck << reserved);
 
   bool isRetransmission = false;
   if (seq != m_tcb->m_highTxMark)
@@ -2815,7 +3058,9 @@ TcpSocketBase::SendDataPacketReal (SequenceNumber32 seq, uint32_t maxSize, bool
   m_congestionControl->Send(this, m_tcb, seq, isRetransmission); 
   ////////////////////////////////////////////////////////
 
-  Ptr<Packet> p = m_txBuffer->CopyFromSequence (maxSize, seq);
+  // A reserved block whose head was acknowledged meanwhile starts later
+  Ptr<Packet> p = reserved > 0 ? m_txBuffer->CopyReserved (reserved, seq)
+                                : m_txBuffer->CopyFromSequence (maxSize, seq);
   uint32_t sz = p->GetSize (); // Size of packet
   uint8_t flags = withAck ? TcpHeader::ACK : 0;
   uint32_t remainingData = m_txBuffer->SizeFromSequence (seq + SequenceNumber32 (sz));
@@ -2883,21 +3128,31 @@ TcpSocketBase::SendDataPacketReal (SequenceNumber32 seq, uint32_t maxSize, bool
         }
     }
   TcpHeader header;
-  header.SetFlags (flags);
-  header.SetSequenceNumber (seq);
-  header.SetAckNumber (m_rxBuffer->NextRxSequence ());
-  if (m_endPoint)
+  if (m_txBatching)
     {
-      header.SetSourcePort (m_endPoint->GetLocalPort ());
-      header.SetDestinationPort (m_endPoint->GetPeerPort ());
+      // Inside a batch only the sequence number and the flags change
+      header = m_txTemplate;
+      header.SetFlags (flags);
+      header.SetSequenceNumber (seq);
     }
   else
     {
-      header.SetSourcePort (m_endPoint6->GetLocalPort ());
-      header.SetDestinationPort (m_endPoint6->GetPeerPort ());
+      header.SetFlags (flags);
+      header.SetSequenceNumber (seq);
+      header.SetAckNumber (m_rxBuffer->NextRxSequence ());
+      if (m_endPoint)
+        {
+          header.SetSourcePort (m_endPoint->GetLocalPort ());
+          header.SetDestinationPort (m_endPoint->GetPeerPort ());
+        }
+      else
+        {
+          header.SetSourcePort (m_endPoint6->GetLocalPort ());
+          header.SetDestinationPort (m_endPoint6->GetPeerPort ());
+        }
+      header.SetWindowSize (AdvertisedWindowSize ());
+      AddOptions (header);
     }
-  header.SetWindowSize (AdvertisedWindowSize ());
-  AddOptions (header);
 
   if (m_retxEvent.IsExpired ())
     {
@@ -2911,7 +3166,13 @@ TcpSocketBase::SendDataPacketReal (SequenceNumber32 seq, uint32_t maxSize, bool
 
   m_txTrace (p, header, this);
 
-  if (m_endPoint)
+  if (m_txBatching)
+    {
+      m_txBatch.push_back (std::make_pair (p, header));
+      NS_LOG_DEBUG ("Batch segment of size " << sz << " with remaining data " <<
+                    remainingData << ". Header " << header);
+    }
+  else if (m_endPoint)
     {
       m_tcp->SendPacket (p, header, m_endPoint->GetLocalAddress (),
                          m_endPoint->GetPeerAddress (), m_boundnetdevice);
@@ -2933,8 +3194,15 @@ TcpSocketBase::SendDataPacketReal (SequenceNumber32 seq, uint32_t maxSize, bool
   // Notify the application of the data being sent unless this is a retransmit
   if (seq + sz > m_tcb->m_highTxMark)
     {
-      Simulator::ScheduleNow (&TcpSocketBase::NotifyDataSent, this,
-                              (seq + sz - m_tcb->m_highTxMark.Get ()));
+      if (m_sentBurst)
+        {
+          m_sentBurstBytes += seq + sz - m_tcb->m_highTxMark.Get ();
+        }
+      else
+        {
+          Simulator::ScheduleNow (&TcpSocketBase::NotifyDataSent, this,
+                                  (seq + sz - m_tcb->m_highTxMark.Get ()));
+        }
     }
   // Update highTxMark
   m_tcb->m_highTxMark = std::max (seq + sz, m_tcb->m_highTxMark.Get ());
@@ -2942,6 +3210,13 @@ TcpSocketBase::SendDataPacketReal (SequenceNumber32 seq, uint32_t maxSize, bool
   return sz;
 }
 
+/// Order of a sequence number and an RttHistory entry, for std::upper_bound
+static bool
+RttHistorySeqLess (const SequenceNumber32 &seq, const RttHistory &h)
+{
+  return seq < h.seq;
+}
+
 void
 TcpSocketBase::UpdateRttHistory (const SequenceNumber32 &seq, uint32_t sz,
                                  bool isRetransmission)
@@ -2955,13 +3230,17 @@ TcpSocketBase::UpdateRttHistory (const SequenceNumber32 &seq, uint32_t sz,
     }
   else
     { // This is a retransmit, find in list and mark as re-tx
-      for (RttHistory_t::iterator i = m_history.begin (); i != m_history.end (); ++i)
+      // The entries are sorted by seq: the segment can only be in the last
+      // one that starts at or before seq
+      RttHistory_t::iterator i = std::upper_bound (m_history.begin (), m_history.end (),
+                                                   seq, RttHistorySeqLess);
+      if (i != m_history.begin ())
         {
-          if ((seq >= i->seq) && (seq < (i->seq + SequenceNumber32 (i->count))))
+          --i;
+          if (seq < (i->seq + SequenceNumber32 (i->count)))
             { // Found it
               i->retx = true;
               i->count = ((seq + SequenceNumber32 (sz)) - i->seq); // And update count in hist
-              break;
             }
         }
     }
@@ -2982,9 +3261,22 @@ TcpSocketBase::SendPendingData (bool withAck)
       return false; // Is this the right way to handle this condition?
     }
 
+  // Queue the QEDs of the entanglements that decohered, before the SENDs
+  // waiting for them stall the connection
+  m_txBuffer->ReclaimExpired ();
+
   uint32_t nPacketsSent = 0;
   uint32_t availableWindow = AvailableWindow ();
 
+  if (m_batchedTx)
+    {
+      BeginTxBatch ();
+    }
+  if (m_coalesceSent)
+    {
+      BeginSentBurst ();
+    }
+
   // RFC 6675, Section (C)
   // If cwnd - pipe >= 1 SMSS, the sender SHOULD transmit one or more
   // segments as follows:
@@ -3000,20 +3292,11 @@ TcpSocketBase::SendPendingData (bool withAck)
           break;
         }
 
-   if (m_txBuffer->qidnum()==0&&m_txBuffer->QidSize()>0&&m_txBuffer->QidSize()==m_txBuffer->QidsentSize()&&m_txBuffer->Size()>0)
+      if (m_txBuffer->IsBlockedOnEntanglement ())
         {
-          NS_LOG_INFO ("qidsize==qidsentSize;2 no data to transmit");
-
-  break;
-       
+          NS_LOG_INFO ("Blocked on entanglement;2 no data to transmit");
+          break;
         }
-    if (m_txBuffer->qidnum()==0&&m_txBuffer->AppSize()>0&&m_txBuffer->AppSize()==m_txBuffer->AppsentSize()&&m_txBuffer->Size()>0)
-        {
-          NS_LOG_INFO ("appsize==appsentSize;2 no data to transmit");
-
-  break;
-        
-        } 
 
       // (C.1) The scoreboard MUST be queried via NextSeg () for the
       //       sequence number range of the next segment to transmit (if
@@ -3021,6 +3304,7 @@ TcpSocketBase::SendPendingData (bool withAck)
       //       failure (no data to send), return without sending anything
       //       (i.e., terminate steps C.1 -- C.5).
       SequenceNumber32 next;
+      uint32_t sz = 0;
       if (!m_txBuffer->NextSeg (&next, m_retxThresh, m_tcb->m_segmentSize,
                                 m_tcb->m_congState == TcpSocketState::CA_RECOVERY))
         {
@@ -3048,6 +3332,21 @@ TcpSocketBase::SendPendingData (bool withAck)
               break;
             }
 
+          // New data waits for an entanglement when the QEDs ahead of their
+          // SEND reached the QedLookahead depth
+          if (next >= m_tcb->m_highTxMark && m_txBuffer->IsQedLookaheadFull ())
+            {
+              NS_LOG_LOGIC ("QED lookahead full (" << m_txBuffer->GetQedAhead () <<
+                            "). Wait to send.");
+              break;
+            }
+          // The pair of the next SEND was lost and its QED is not queued yet
+          if (next >= m_tcb->m_highTxMark && m_txBuffer->IsSendStarved ())
+            {
+              NS_LOG_LOGIC ("No entanglement for the next SEND. Wait to send.");
+              break;
+            }
+
          
 
           uint32_t s = std::min (availableWindow, m_tcb->m_segmentSize);
@@ -3066,7 +3365,12 @@ TcpSocketBase::SendPendingData (bool withAck)
               m_tcb->m_nextTxSequence = next;
             }
 
-          uint32_t sz = SendDataPacket (m_tcb->m_nextTxSequence, s, withAck);
+          sz = SendDataPacket (m_tcb->m_nextTxSequence, s, withAck);
+          if (sz == 0)
+            {
+              NS_LOG_LOGIC ("Nothing to transmit at " << next << ". Wait to send.");
+              break;
+            }
           m_tcb->m_nextTxSequence += sz;
 
           NS_LOG_LOGIC (" rxwin " << m_rWnd <<
@@ -3087,13 +3391,30 @@ TcpSocketBase::SendPendingData (bool withAck)
       //       network must be updated by incrementing pipe by the number
       //       of octets transmitted in (C.1).
       //
-      // Done in BytesInFlight, inside AvailableWindow.
-      availableWindow = AvailableWindow ();
+      // Done in BytesInFlight, inside AvailableWindow. A batch spends the
+      // window locally, and asks again only when it looks exhausted.
+      if (m_txBatching && sz > 0 && availableWindow > sz)
+        {
+          availableWindow -= sz;
+        }
+      else
+        {
+          availableWindow = AvailableWindow ();
+        }
 
       // (C.5) If cwnd - pipe >= 1 SMSS, return to (C.1)
       // loop again!
     }
 
+  if (m_txBatching)
+    {
+      FlushTxBatch ();
+    }
+  if (m_sentBurst)
+    {
+      EndSentBurst ();
+    }
+
   if (nPacketsSent > 0)
     {
       NS_LOG_DEBUG ("SendPendingData sent " << nPacketsSent << " segments");
@@ -3158,15 +3479,16 @@ TcpSocketBase::BytesInFlight () const
 
   NS_LOG_DEBUG ("Returning calculated bytesInFlight: " << bytesInFlight);
 
-  // Compute adjusted queue: inflight - pacing queue
-  auto pacing_bytes = pacingQueueBytes();
-  int adj_bytes = bytesInFlight - pacing_bytes;
+  // Compute adjusted queue: inflight - pacing queue. The queued segments
+  // already left the Tx buffer, but not the host.
+  uint32_t pacing_bytes = m_pacing_bytes;
+  m_tcb->m_pacedInFlight = SafeSubtraction (bytesInFlight, pacing_bytes);
 
   NS_LOG_INFO(this <<
               " DATA Pacing queue pkts: " << m_pacing_packets.size() << 
               "  bytes: " << pacing_bytes << 
               "  inflight: " << bytesInFlight << 
-              "  inflight adjusted: " << adj_bytes);
+              "  inflight adjusted: " << m_tcb->m_pacedInFlight);
 
   return bytesInFlight;
 }
@@ -3278,6 +3600,10 @@ TcpSocketBase::ReceivedData (Ptr<Packet> p, const TcpHeader& tcpHeader)
     { // NextRxSeq advanced, we have something to send to the app
       if (!m_shutdownRecv)
         {
+          if (m_qtcpDecoding)
+            {
+              FillDecoder ();
+            }
           NotifyDataRecv ();
         }
       // Handle exceptions
@@ -3322,26 +3648,24 @@ TcpSocketBase::ReceivedData (Ptr<Packet> p, const TcpHeader& tcpHeader)
  * Called by ForwardUp() to estimate RTT.
  *
  * \param tcpHeader TCP header for the incoming packet
+ * \param options options of the incoming packet
  */
 void
-TcpSocketBase::EstimateRtt (const TcpHeader& tcpHeader)
+TcpSocketBase::EstimateRtt (const TcpHeader& tcpHeader, const TcpAckOptions &options)
 {
   SequenceNumber32 ackSeq = tcpHeader.GetAckNumber ();
   Time m = Time (0.0);
 
   // An ack has been received, calculate rtt and log this measurement
-  // Note we use a linear search (O(n)) for this since for the common
-  // case the ack'ed packet will be at the head of the list
+  // The ack'ed packet is at the head of the list
   if (!m_history.empty ())
     {
       RttHistory& h = m_history.front ();
       if (!h.retx && ackSeq >= (h.seq + SequenceNumber32 (h.count)))
         { // Ok to use this sample
-          if (m_timestampEnabled && tcpHeader.HasOption (TcpOption::TS))
+          if (m_timestampEnabled && options.ts)
             {
-              Ptr<const TcpOptionTS> ts;
-              ts = DynamicCast<const TcpOptionTS> (tcpHeader.GetOption (TcpOption::TS));
-              m = TcpOptionTS::ElapsedTimeFromTsValue (ts->GetEcho ());
+              m = TcpOptionTS::ElapsedTimeFromTsValue (options.ts->GetEcho ());
             }
           else
             {
@@ -3350,7 +3674,8 @@ TcpSocketBase::EstimateRtt (const TcpHeader& tcpHeader)
         }
     }
 
-  // Now delete all ack history with seq <= ack
+  // Now delete all ack history with seq <= ack (each entry is removed
+  // once, so the cost is spread over the segments sent)
   while (!m_history.empty ())
     {
       RttHistory& h = m_history.front ();
@@ -3366,8 +3691,8 @@ TcpSocketBase::EstimateRtt (const TcpHeader& tcpHeader)
       m_rtt->Measurement (m);                // Log the measurement
       // RFC 6298, clause 2.4
       m_rto = Max (m_rtt->GetEstimate () + Max (m_clockGranularity, m_rtt->GetVariation () * 4), m_minRto);
-      m_lastRtt = m_rtt->GetEstimate ();
-      NS_LOG_FUNCTION (this << m_lastRtt);
+      m_lastRtt = m;                         // The sample, not the estimate
+      NS_LOG_FUNCTION (this << m_lastRtt << m_rtt->GetEstimate ());
     }
 }
 
@@ -3381,6 +3706,7 @@ TcpSocketBase::NewAck (SequenceNumber32 const& ack, bool resetRTO)
 
   // Reset the data retransmission count. We got a new ACK!
   m_dataRetrCount = m_dataRetries;
+  m_qedRetrCount = m_qedRetries;
 
   if (m_state != SYN_RCVD && resetRTO)
     { // Set RTO unless the ACK is received in SYN_RCVD state
@@ -3400,6 +3726,15 @@ TcpSocketBase::NewAck (SequenceNumber32 const& ack, bool resetRTO)
   // Note the highest ACK and tell app to send more
   NS_LOG_LOGIC ("TCP " << this << " NewAck " << ack <<
                 " numberAck " << (ack - m_txBuffer->HeadSequence ())); // Number bytes ack'ed
+  if (m_adaptiveRed && m_tcb->m_congState == TcpSocketState::CA_OPEN)
+    {
+      // A whole window acknowledged without loss lowers the redundancy
+      m_redCleanBytes += ack - m_txBuffer->HeadSequence ();
+      if (m_redCleanBytes >= m_tcb->m_cWnd)
+        {
+          AdaptRedundancy (false);
+        }
+    }
   m_txBuffer->DiscardUpTo (ack);
   if (GetTxAvailable () > 0)
     {
@@ -3433,24 +3768,19 @@ TcpSocketBase::ReTxTimeout ()
     {
       return;
     }
-    if (m_txBuffer->qidnum()==0&&m_txBuffer->QidSize()>=0&&m_txBuffer->QidSize()==m_txBuffer->QidsentSize()&&m_txBuffer->Size()>0)
-        {
-          NS_LOG_INFO ("qidsize==qidsentSize;22");
- // SendEmptyPacket (TcpHeader::FIN);
-DoRetransmit ();
-        return;
-        }
-    if (m_txBuffer->qidnum()==0&&m_txBuffer->AppSize()>=0&&m_txBuffer->AppSize()==m_txBuffer->AppsentSize()&&m_txBuffer->Size()>0)
-        {
-          NS_LOG_INFO ("appsize==appsentSize;22");
-//  SendEmptyPacket (TcpHeader::FIN);
-DoRetransmit ();
-        return ;
-        }
+  if (m_txBuffer->IsWaitingForEntanglement ())
+    {
+      NS_LOG_INFO ("Waiting for an entanglement;22");
+      AdaptRedundancy (true);
+      DoRetransmit ();
+      return;
+    }
 
 
   uint32_t inFlightBeforeRto = BytesInFlight();  
 
+  AdaptRedundancy (true);
+
   // From RFC 6675, Section 5.1
   // [RFC2018] suggests that a TCP sender SHOULD expunge the SACK
   // information gathered from a receiver upon a retransmission timeout
@@ -3516,8 +3846,7 @@ DoRetransmit ();
   // Clear any remaining packets in pacing queue.
   NS_LOG_DEBUG("RTO. Clearing pacing queue, packet count: "
                << m_pacing_packets.size());
-  while (!m_pacing_packets.empty())
-    m_pacing_packets.pop();
+  ClearPacing();
   
   NS_LOG_DEBUG ("RTO. Reset cwnd to " <<  m_tcb->m_cWnd << ", ssthresh to " <<
                 m_tcb->m_ssThresh << ", restart from seqnum " <<
@@ -3619,7 +3948,10 @@ TcpSocketBase::DoRetransmit ()
       return;
     }
 
-  if (m_dataRetrCount == 0)
+  // With QedRetries, the retransmissions of a QED head have their own budget
+  uint32_t &retrCount = (m_qedRetries > 0 && m_txBuffer->IsHeadQed ()) ?
+    m_qedRetrCount : m_dataRetrCount;
+  if (retrCount == 0)
     {
       NS_LOG_INFO ("No more data retries available. Dropping connection");
       NotifyErrorClose ();
@@ -3628,7 +3960,7 @@ TcpSocketBase::DoRetransmit ()
     }
   else
     {
-      --m_dataRetrCount;
+      --retrCount;
     }
 
   // Retransmit non-data packet: Only if in FIN_WAIT_1 or CLOSING state
@@ -3734,6 +4066,7 @@ TcpSocketBase::SetSegSize (uint32_t size)
 {
   NS_LOG_FUNCTION (this << size);
   m_tcb->m_segmentSize = size;
+  m_txBuffer->SetSegmentSize (size);
 
   NS_ABORT_MSG_UNLESS (m_state == CLOSED, "Cannot change segment size dynamically.");
 }
@@ -3860,6 +4193,76 @@ TcpSocketBase::AddOptions (TcpHeader& header)
     }
 }
 
+void
+TcpSocketBase::BeginTxBatch (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  // The ACK number, the window and the timestamps do not change while
+  // SendPendingData runs: build them once for every segment of the batch
+  m_txTemplate = TcpHeader ();
+  m_txTemplate.SetAckNumber (m_rxBuffer->NextRxSequence ());
+  if (m_endPoint)
+    {
+      m_txTemplate.SetSourcePort (m_endPoint->GetLocalPort ());
+      m_txTemplate.SetDestinationPort (m_endPoint->GetPeerPort ());
+    }
+  else
+    {
+      m_txTemplate.SetSourcePort (m_endPoint6->GetLocalPort ());
+      m_txTemplate.SetDestinationPort (m_endPoint6->GetPeerPort ());
+    }
+  m_txTemplate.SetWindowSize (AdvertisedWindowSize ());
+  AddOptions (m_txTemplate);
+
+  m_txBatch.clear ();
+  m_txBatching = true;
+}
+
+void
+TcpSocketBase::FlushTxBatch (void)
+{
+  NS_LOG_FUNCTION (this << m_txBatch.size ());
+
+  m_txBatching = false;
+  for (std::vector<std::pair<Ptr<Packet>, TcpHeader> >::const_iterator it = m_txBatch.begin ();
+       it != m_txBatch.end (); ++it)
+    {
+      if (m_endPoint)
+        {
+          m_tcp->SendPacket (it->first, it->second, m_endPoint->GetLocalAddress (),
+                             m_endPoint->GetPeerAddress (), m_boundnetdevice);
+        }
+      else
+        {
+          m_tcp->SendPacket (it->first, it->second, m_endPoint6->GetLocalAddress (),
+                             m_endPoint6->GetPeerAddress (), m_boundnetdevice);
+        }
+    }
+  NS_LOG_DEBUG ("Sent a batch of " << m_txBatch.size () << " segments via TcpL4Protocol");
+  m_txBatch.clear ();
+}
+
+void
+TcpSocketBase::BeginSentBurst (void)
+{
+  NS_LOG_FUNCTION (this);
+  m_sentBurstBytes = 0;
+  m_sentBurst = true;
+}
+
+void
+TcpSocketBase::EndSentBurst (void)
+{
+  NS_LOG_FUNCTION (this << m_sentBurstBytes);
+  m_sentBurst = false;
+  if (m_sentBurstBytes > 0)
+    {
+      Simulator::ScheduleNow (&TcpSocketBase::NotifyDataSent, this, m_sentBurstBytes);
+      m_sentBurstBytes = 0;
+    }
+}
+
 void
 TcpSocketBase::ProcessOptionWScale (const Ptr<const TcpOption> option)
 {
@@ -3926,13 +4329,11 @@ TcpSocketBase::AddOptionWScale (TcpHeader &header)
 }
 
 bool
-TcpSocketBase::ProcessOptionSack (const Ptr<const TcpOption> option)
+TcpSocketBase::ProcessOptionSack (const Ptr<const TcpOptionSack> option)
 {
   NS_LOG_FUNCTION (this << option);
 
-  Ptr<const TcpOptionSack> s = DynamicCast<const TcpOptionSack> (option);
-  TcpOptionSack::SackList list = s->GetSackList ();
-  return m_txBuffer->Update (list);
+  return m_txBuffer->Update (option->GetSackList ());
 }
 
 void
@@ -3988,23 +4389,21 @@ TcpSocketBase::AddOptionSack (TcpHeader& header)
 }
 
 void
-TcpSocketBase::ProcessOptionTimestamp (const Ptr<const TcpOption> option,
+TcpSocketBase::ProcessOptionTimestamp (const Ptr<const TcpOptionTS> option,
                                        const SequenceNumber32 &seq)
 {
   NS_LOG_FUNCTION (this << option);
 
-  Ptr<const TcpOptionTS> ts = DynamicCast<const TcpOptionTS> (option);
-
-  m_tcb->m_rcvTimestampValue = ts->GetTimestamp ();
-  m_tcb->m_rcvTimestampEchoReply = ts->GetEcho();
+  m_tcb->m_rcvTimestampValue = option->GetTimestamp ();
+  m_tcb->m_rcvTimestampEchoReply = option->GetEcho();
 
   if (seq == m_rxBuffer->NextRxSequence () && seq <= m_highTxAck)
     {
-      m_timestampToEcho = ts->GetTimestamp ();
+      m_timestampToEcho = option->GetTimestamp ();
     }
 
   NS_LOG_INFO (m_node->GetId () << " Got timestamp=" <<
-               m_timestampToEcho << " and Echo="     << ts->GetEcho ());
+               m_timestampToEcho << " and Echo="     << option->GetEcho ());
 }
 
 void
@@ -4092,6 +4491,33 @@ TcpSocketBase::GetClockGranularity (void) const
   return m_clockGranularity;
 }
 
+void
+TcpSocketBase::SetRetxThresh (uint32_t retxThresh)
+{
+  NS_LOG_FUNCTION (this << retxThresh);
+  m_retxThresh = retxThresh;
+  m_txBuffer->SetDupAckThresh (retxThresh);
+}
+
+uint32_t
+TcpSocketBase::GetRetxThresh (void) const
+{
+  return m_retxThresh;
+}
+
+void
+TcpSocketBase::SetQedLossPolicy (TcpTxBuffer::QedLossPolicy policy)
+{
+  NS_LOG_FUNCTION (this << policy);
+  m_txBuffer->SetQedLossPolicy (policy);
+}
+
+TcpTxBuffer::QedLossPolicy
+TcpSocketBase::GetQedLossPolicy (void) const
+{
+  return m_txBuffer->GetQedLossPolicy ();
+}
+
 Ptr<TcpTxBuffer>
 TcpSocketBase::GetTxBuffer (void) const
 {
@@ -4203,16 +4629,35 @@ void TcpSocketBase::SetPacingRate (double pacing_rate) {
   m_tcb -> SetPacingRate(pacing_rate);
 }
  
-// Compute total bytes in pacing packet queue.
+// Get pacing configuration.
+enum_pacing_config TcpSocketBase::GetPacingMode (void) const {
+  return m_pacingMode;
+}
+
+// Total bytes in pacing packet queue, kept by PushPacing/PopPacing.
 int TcpSocketBase::pacingQueueBytes (void) const {
-  int pacing_bytes = 0;
-  std::queue<tcp_pacing_struct> temp_q = m_pacing_packets;
-  while (!temp_q.empty()) {
-    tcp_pacing_struct packet = m_pacing_packets.front();
-    pacing_bytes += packet.maxSize;
-    temp_q.pop();
-  }
-  return pacing_bytes;
+  return m_pacing_bytes;
+}
+
+// Queue a packet for pacing.
+void TcpSocketBase::PushPacing (const tcp_pacing_struct &packet) {
+  m_pacing_packets.push(packet);
+  m_pacing_bytes += packet.size;
+}
+
+// Take the next packet to pace.
+tcp_pacing_struct TcpSocketBase::PopPacing () {
+  tcp_pacing_struct packet = m_pacing_packets.front();
+  m_pacing_packets.pop();
+  m_pacing_bytes -= packet.size;
+  return packet;
+}
+
+// Drop all the packets waiting for pacing.
+void TcpSocketBase::ClearPacing () {
+  while (!m_pacing_packets.empty())
+    m_pacing_packets.pop();
+  m_pacing_bytes = 0;
 }
 
 // ADDITIONS FOR PACING: END
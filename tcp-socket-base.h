@@ -30,7 +30,7 @@
 // NO_PACING - No packet pacing is done (BBR' adjusts accordingly).
 enum enum_pacing_config {TCP_PACING, APP_PACING, NO_PACING};
 
-// Actual configuration option.
+// Default configuration option (ns3::TcpSocketBase::PacingMode attribute).
 const enum_pacing_config PACING_CONFIG = TCP_PACING;
 //const enum_pacing_config PACING_CONFIG = NO_PACING;
 //const enum_pacing_config PACING_CONFIG = APP_PACING;
@@ -42,6 +42,7 @@ const float PACING_VERSION = 1.1;  // See changelog.txt.
 
 #include <stdint.h>
 #include <queue>
+#include <vector>
 #include "ns3/callback.h"
 #include "ns3/traced-value.h"
 #include "ns3/tcp-socket.h"
@@ -52,8 +53,12 @@ const float PACING_VERSION = 1.1;  // See changelog.txt.
 #include "ns3/ipv6-header.h"
 #include "ns3/ipv6-interface.h"
 #include "ns3/event-id.h"
+#include "ns3/tcp-header.h"
+#include "ns3/tcp-option-sack.h"
+#include "ns3/tcp-option-ts.h"
 #include "tcp-tx-buffer.h"
 #include "tcp-rx-buffer.h"
+#include "qtcp-decoder.h"
 #include "rtt-estimator.h"
 
 namespace ns3 {
@@ -93,9 +98,24 @@ public:
   bool            retx;   //!< True if this has been retransmitted
 };
 
-/// Container for RttHistory objects
+/// Container for RttHistory objects, ordered by sequence number
 typedef std::deque<RttHistory> RttHistory_t;
 
+/**
+ * \ingroup tcp
+ *
+ * \brief Options of a received segment read on the ACK path
+ *
+ * Filled by one pass over the options of the header (see
+ * TcpSocketBase::ReadAckOptions), then read without searching the header
+ * again.
+ */
+struct TcpAckOptions
+{
+  Ptr<const TcpOptionSack> sack; //!< SACK option, or 0
+  Ptr<const TcpOptionTS>   ts;   //!< Timestamp option, or 0
+};
+
 /**
  * \brief Data structure that records the congestion state of a connection
  *
@@ -186,6 +206,8 @@ public:
   uint32_t               m_rcvTimestampValue;     //!< Receiver Timestamp value 
   uint32_t               m_rcvTimestampEchoReply; //!< Sender Timestamp echoed by the receiver
 
+  uint32_t               m_pacedInFlight;   //!< Bytes in flight, less the ones still in the pacing queue
+
   /**
    * \brief Get cwnd in segments rather than bytes
    *
@@ -221,6 +243,7 @@ struct tcp_pacing_struct {
   SequenceNumber32 seq;    // Seq location in TCP buffer.
   uint32_t maxSize;        // Bytes to extract.
   bool withAck;            // Include ack or not.
+  uint32_t size;           // Bytes taken from the TCP buffer.
 };
   
 // ADDITIONS FOR PACING: END
@@ -324,7 +347,9 @@ struct tcp_pacing_struct {
  *
  * SYN and SYN-ACK options, which are allowed only at the beginning of the
  * connection, are managed in the DoForwardUp and SendEmptyPacket methods.
- * To read all others, we have set up a cycle inside ReadOptions. For adding
+ * The SACK and timestamp options of every received segment are read once by
+ * ReadAckOptions, in DoForwardUp, and handed to ReadOptions and EstimateRtt.
+ * For adding
  * them, there is no a unique place, since the options (and the information
  * available to build them) are scattered around the code. For instance,
  * the SACK option is built in SendEmptyPacket only under certain conditions.
@@ -416,6 +441,30 @@ public:
    */
   Time GetClockGranularity (void) const;
 
+  /**
+   * \brief Set the retransmission threshold (dup ack threshold for a fast retransmit)
+   * \param retxThresh the threshold
+   */
+  void SetRetxThresh (uint32_t retxThresh);
+
+  /**
+   * \brief Get the retransmission threshold (dup ack threshold for a fast retransmit)
+   * \return the threshold
+   */
+  uint32_t GetRetxThresh (void) const;
+
+  /**
+   * \brief Set the recovery of the lost QED records (TcpTxBuffer::QedLossPolicy)
+   * \param policy the policy
+   */
+  void SetQedLossPolicy (TcpTxBuffer::QedLossPolicy policy);
+
+  /**
+   * \brief Get the recovery of the lost QED records
+   * \return the policy
+   */
+  TcpTxBuffer::QedLossPolicy GetQedLossPolicy (void) const;
+
   /**
    * \brief Get a pointer to the Tx buffer
    * \return a pointer to the tx buffer
@@ -518,6 +567,20 @@ public:
   virtual int GetPeerName (Address &address) const;
   virtual void BindToNetDevice (Ptr<NetDevice> netdevice); // NetDevice with my m_endPoint
 
+  /**
+   * \brief Send a batch of application packets
+   *
+   * Same as calling Send () on each packet, but the packets are queued in
+   * the Tx buffer with one capacity check (TcpTxBuffer::AddBatch), and the
+   * transmission is scheduled once.
+   *
+   * \param packets the packets, each one a QTCP message
+   * \param flags must be 0
+   * \returns the number of bytes queued (the first packets that fit), or -1
+   * if none could be queued
+   */
+  int SendBatch (const std::vector<Ptr<Packet> > &packets, uint32_t flags = 0);
+
   /**
    * TracedCallback signature for tcp packet transmission or reception events.
    *
@@ -682,6 +745,12 @@ protected:
    */
   uint32_t SendPendingData (bool withAck = false);
 
+  /**
+   * \brief Schedule SendPendingData after the data queued by the application,
+   * if the window allows it and it is not scheduled yet
+   */
+  void ScheduleSendPendingData (void);
+
   /**
    * \brief Extract at most maxSize bytes from the TxBuffer at sequence seq, add the
    *        TCP header, and send to TcpL4Protocol
@@ -692,7 +761,19 @@ protected:
    * \returns the number of bytes sent
    */
   uint32_t SendDataPacket (SequenceNumber32 seq, uint32_t maxSize, bool withAck);
-  uint32_t SendDataPacketReal (SequenceNumber32 seq, uint32_t maxSize, bool withAck);
+
+  /**
+   * \brief Send the data packet now (SendDataPacket without pacing)
+   *
+   * \param seq the sequence number
+   * \param maxSize the maximum data block to be transmitted (in bytes)
+   * \param withAck forces an ACK to be sent
+   * \param reserved size of the block reserved at seq with
+   *        TcpTxBuffer::Reserve (paced packets), or 0 to take it now
+   * \returns the number of bytes sent
+   */
+  uint32_t SendDataPacketReal (SequenceNumber32 seq, uint32_t maxSize, bool withAck,
+                               uint32_t reserved = 0);
 
   /**
    * \brief Send a empty packet that carries a flag, e.g., ACK
@@ -927,15 +1008,34 @@ protected:
    */
   virtual void ReceivedData (Ptr<Packet> packet, const TcpHeader& tcpHeader);
 
+  /**
+   * \brief Extract the payload of the SEND records received in order,
+   * dropping the QTCP framing (QtcpDecoding attribute)
+   * \param maxSize maximum number of bytes to return
+   * \returns the payload, 0 if no SEND record is complete, or an empty
+   * packet at the end of the connection
+   */
+  Ptr<Packet> RecvPayload (uint32_t maxSize);
+
+  /**
+   * \brief Move in-order bytes from the Rx buffer into the QTCP decoder,
+   * until it holds the payload of a complete SEND record
+   */
+  void FillDecoder (void);
+
   /**
    * \brief Take into account the packet for RTT estimation
    * \param tcpHeader the packet's TCP header
+   * \param options the packet's options, from ReadAckOptions
    */
-  virtual void EstimateRtt (const TcpHeader& tcpHeader);
+  virtual void EstimateRtt (const TcpHeader& tcpHeader, const TcpAckOptions &options);
 
   /**
    * \brief Update the RTT history, when we send TCP segments
    *
+   * New segments are appended at the back, so the history stays sorted by
+   * sequence number and a retransmission is found by binary search.
+   *
    * \param seq The sequence number of the TCP segment
    * \param sz The segment's size
    * \param isRetransmission Whether or not the segment is a retransmission
@@ -966,6 +1066,24 @@ protected:
    */
   void EnterRecovery ();
 
+  /**
+   * \brief Move the redundancy length of the next messages (AdaptiveRedundancy)
+   *
+   * A loss raises it by RedundancyStep, times the retransmissions of the head
+   * since the last new ACK; a window acknowledged without loss lowers it by
+   * RedundancyStep. It stays within [MinRedundancy, MaxRedundancy].
+   *
+   * \param loss true on a loss event (fast retransmit or RTO), false after a
+   * window acknowledged without loss
+   */
+  void AdaptRedundancy (bool loss);
+
+  /**
+   * \brief Check the AdaptiveRedundancy bounds and report the initial
+   * redundancy length, once the attributes are applied
+   */
+  void InitRedundancy (void);
+
   /**
    * \brief An RTO event happened
    */
@@ -1000,16 +1118,49 @@ protected:
    */
   void AddOptions (TcpHeader& tcpHeader);
 
+  /**
+   * \brief Start collecting the data segments (BatchedTransmit)
+   *
+   * Builds the header fields shared by the segments of one SendPendingData
+   * call: ports, ACK number, window and options. SendDataPacketReal then
+   * patches only the sequence number and the flags, and queues the segment.
+   */
+  void BeginTxBatch (void);
+
+  /**
+   * \brief Give the segments collected since BeginTxBatch to TcpL4Protocol
+   */
+  void FlushTxBatch (void);
+
+  /**
+   * \brief Start adding up the new bytes sent (CoalesceDataSent)
+   */
+  void BeginSentBurst (void);
+
+  /**
+   * \brief Notify the application once of the new bytes sent since
+   * BeginSentBurst
+   */
+  void EndSentBurst (void);
+
   /**
    * \brief Read TCP options begore Ack processing
    *
    * Timestamp and Window scale are managed in other pieces of code.
    *
-   * \param tcpHeader Header of the segment
+   * \param options Options of the segment, from ReadAckOptions
    * \param scoreboardUpdated indicates if the scoreboard was updated due to a
    * SACK option
    */
-  void ReadOptions (const TcpHeader &tcpHeader, bool &scoreboardUpdated);
+  void ReadOptions (const TcpAckOptions &options, bool &scoreboardUpdated);
+
+  /**
+   * \brief Find the SACK and timestamp options of a segment in one pass
+   *
+   * \param tcpHeader Header of the segment
+   * \param options Options found (0 for the absent ones)
+   */
+  void ReadAckOptions (const TcpHeader &tcpHeader, TcpAckOptions &options) const;
 
   /**
    * \brief Return true if the specified option is enabled
@@ -1063,7 +1214,7 @@ protected:
    * \param option SACK option from the header
    * \returns true in case of an update to the SACKed blocks
    */
-  bool ProcessOptionSack (const Ptr<const TcpOption> option);
+  bool ProcessOptionSack (const Ptr<const TcpOptionSack> option);
 
   /**
    * \brief Add the SACK PERMITTED option to the header
@@ -1089,7 +1240,7 @@ protected:
    * \param option Option from the segment
    * \param seq Sequence number of the segment
    */
-  void ProcessOptionTimestamp (const Ptr<const TcpOption> option,
+  void ProcessOptionTimestamp (const Ptr<const TcpOptionTS> option,
                                const SequenceNumber32 &seq);
   /**
    * \brief Add the timestamp option to the header
@@ -1118,12 +1269,20 @@ public:
   void SetPacingRate (double pacing_rate);
   double GetPacingRate () const;
   virtual int pacingQueueBytes (void) const;
+  enum_pacing_config GetPacingMode (void) const;
 
 protected:
   EventId           m_pacing_event;                // Pacing event.
   std::queue<tcp_pacing_struct> m_pacing_packets;  // Pacing packets.
+  uint32_t          m_pacing_bytes;                // Bytes in the pacing queue.
+  enum_pacing_config m_pacingMode;                 // Pacing configuration (PacingMode).
+  uint32_t          m_pacingBurst;                 // Segments sent per pacing event.
 private:
   void PacePackets();
+  // The pacing queue is changed only through these, which keep m_pacing_bytes.
+  void PushPacing (const tcp_pacing_struct &packet);
+  tcp_pacing_struct PopPacing ();
+  void ClearPacing ();
   // ADDITIONS FOR PACING: END
   //////////////////////////////
   
@@ -1142,6 +1301,8 @@ protected:
   uint32_t          m_synRetries;      //!< Number of connection attempts
   uint32_t          m_dataRetrCount;   //!< Count of remaining data retransmission attempts
   uint32_t          m_dataRetries;     //!< Number of data retransmission attempts
+  uint32_t          m_qedRetrCount;    //!< Count of remaining retransmission attempts of a QED head
+  uint32_t          m_qedRetries;      //!< Number of retransmission attempts of a QED head (0: DataRetries)
   TracedValue<Time> m_rto;             //!< Retransmit timeout
   Time              m_minRto;          //!< minimum value of the Retransmit timeout
   Time              m_clockGranularity; //!< Clock Granularity used in RTO calcs
@@ -1208,6 +1369,30 @@ protected:
   // Guesses over the other connection end
   bool m_isFirstPartialAck; //!< First partial ACK during RECOVERY
 
+  // QTCP
+  bool        m_qtcpDecoding; //!< Give only the SEND payload to the application
+  QtcpDecoder m_qtcpDecoder;  //!< Parser of the received QTCP records
+
+  bool     m_adaptiveRed;             //!< Adapt the redundancy length to the losses
+  uint8_t  m_minRed;                  //!< Lowest adaptive redundancy length
+  uint8_t  m_maxRed;                  //!< Highest adaptive redundancy length
+  uint8_t  m_redStep;                 //!< Change of the redundancy length per adaptation
+  uint32_t m_redCleanBytes;           //!< Bytes acknowledged since the last adaptation
+  TracedValue<uint32_t> m_redundancy; //!< Redundancy length chosen by the controller
+
+  TcpAckOptions m_rxOptions; //!< Options of the segment being processed, set by DoForwardUp
+
+  // Batched transmission
+  bool      m_batchedTx;    //!< Send the segments of SendPendingData as one batch
+  bool      m_txBatching;   //!< A batch is being collected
+  TcpHeader m_txTemplate;   //!< Header fields shared by the segments of the batch
+  std::vector<std::pair<Ptr<Packet>, TcpHeader> > m_txBatch; //!< Segments of the batch
+
+  // Coalesced data sent notifications
+  bool     m_coalesceSent;    //!< One NotifyDataSent per burst of segments
+  bool     m_sentBurst;       //!< A burst is being sent
+  uint32_t m_sentBurstBytes;  //!< New bytes sent in the current burst
+
   // The following two traces pass a packet with a TCP header
   TracedCallback<Ptr<const Packet>, const TcpHeader&,
                  Ptr<const TcpSocketBase> > m_txTrace; //!< Trace of transmitted packets
@@ -26,8 +26,12 @@
 #include "ns3/log.h"
 #include "ns3/abort.h"
 #include "ns3/tcp-option-ts.h"
+#include "ns3/object-factory.h"
+#include "ns3/boolean.h"
+#include "ns3/pointer.h"
 
 #include "tcp-tx-buffer.h"
+#include "qtcp-header.h"
 
 namespace ns3 {
 NS_LOG_COMPONENT_DEFINE ("TcpTxBuffer");
@@ -37,7 +41,10 @@ TcpTxItem::TcpTxItem ()
     m_retrans (false),
     m_lastSent (Time::Min ()),
     m_sacked (false),
-    m_qided (false)
+    m_qided (false),
+    m_framed (true),
+    m_expiry (Time::Max ()),
+    m_pairs (0)
 {
 }
 
@@ -47,7 +54,11 @@ TcpTxItem::TcpTxItem (const TcpTxItem &other)
     m_retrans (other.m_retrans),
     m_lastSent (other.m_lastSent),
     m_sacked (other.m_sacked),
-    m_qided (other.m_qided)
+    m_qided (other.m_qided),
+    m_framed (other.m_framed),
+    m_expiry (other.m_expiry),
+    m_pairs (other.m_pairs),
+    m_header (other.m_header)
 {
 }
 
@@ -87,6 +98,65 @@ TcpTxItem::Print (std::ostream &os) const
   os << "last sent: " << m_lastSent;
 }
 
+uint32_t
+TcpTxItem::GetSeqSize (void) const
+{
+  return m_framed ? m_packet->GetSize () : m_header.GetRecordLength ();
+}
+
+TcpTxItemPool::TcpTxItemPool ()
+  : m_allocated (0)
+{
+}
+
+TcpTxItemPool::TcpTxItemPool (const TcpTxItemPool &other)
+  : m_allocated (0)
+{
+}
+
+TcpTxItemPool::~TcpTxItemPool ()
+{
+  for (std::vector<TcpTxItem*>::iterator it = m_blocks.begin (); it != m_blocks.end (); ++it)
+    {
+      delete [] *it;
+    }
+}
+
+TcpTxItem*
+TcpTxItemPool::Allocate (void)
+{
+  if (m_free.empty ())
+    {
+      TcpTxItem *block = new TcpTxItem [BLOCK_ITEMS];
+      m_blocks.push_back (block);
+      m_free.reserve (m_blocks.size () * BLOCK_ITEMS);
+      for (uint32_t i = BLOCK_ITEMS; i > 0; --i)
+        {
+          m_free.push_back (block + i - 1);
+        }
+    }
+
+  TcpTxItem *item = m_free.back ();
+  m_free.pop_back ();
+  ++m_allocated;
+  return item;
+}
+
+void
+TcpTxItemPool::Release (TcpTxItem *item)
+{
+  NS_ASSERT (item != 0);
+  // Reset the fields, and drop the reference to the packet now
+  *item = TcpTxItem ();
+  m_free.push_back (item);
+}
+
+uint64_t
+TcpTxItemPool::GetAllocationsAvoided (void) const
+{
+  return m_allocated - m_blocks.size ();
+}
+
 NS_OBJECT_ENSURE_REGISTERED (TcpTxBuffer);
 
 TypeId
@@ -99,15 +169,64 @@ TcpTxBuffer::GetTypeId (void)
     .AddAttribute ("HEADERSIZE", "Header size  bytes",
                    UintegerValue (16),
                    MakeUintegerAccessor (&TcpTxBuffer::m_qheader),
-                   MakeUintegerChecker<uint16_t> ())
+                   MakeUintegerChecker<uint16_t> (QtcpHeader::MIN_LENGTH,
+                                                  QtcpHeader::MAX_LENGTH))
     .AddAttribute ("REDSIZE", "Redundancy length bytes",
                    UintegerValue (24),
                    MakeUintegerAccessor (&TcpTxBuffer::m_red),
-                   MakeUintegerChecker<uint16_t> ())
+                   MakeUintegerChecker<uint8_t> ())
+    .AddAttribute ("EncoderType",
+                   "Type of the encoder of the QED redundancy",
+                   TypeIdValue (QtcpOffsetEncoder::GetTypeId ()),
+                   MakeTypeIdAccessor (&TcpTxBuffer::m_encoderType),
+                   MakeTypeIdChecker ())
+    .AddAttribute ("LazyFraming",
+                   "Keep only a reference to the payload of each message, and "
+                   "build its QED and SEND records when they are transmitted",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&TcpTxBuffer::m_lazyFraming),
+                   MakeBooleanChecker ())
+    .AddAttribute ("QedLookahead",
+                   "Maximum number of QED records transmitted ahead of their "
+                   "SEND. With 0, a QED is sent whenever no entanglement is "
+                   "available, and a SEND otherwise",
+                   UintegerValue (0),
+                   MakeUintegerAccessor (&TcpTxBuffer::m_qedLookahead),
+                   MakeUintegerChecker<uint32_t> ())
+    .AddAttribute ("EntanglementPool",
+                   "Pool of the entanglement pairs used by the SEND records. "
+                   "The connections between the same nodes can share one; "
+                   "by default every buffer has its own",
+                   PointerValue (),
+                   MakePointerAccessor (&TcpTxBuffer::m_pool),
+                   MakePointerChecker<EntanglementPool> ())
+    .AddAttribute ("EntanglementLifetime",
+                   "Time an entanglement stays usable after its QED is "
+                   "transmitted; expired ones are regenerated. 0 means no "
+                   "decoherence",
+                   TimeValue (Seconds (0)),
+                   MakeTimeAccessor (&TcpTxBuffer::m_lifetime),
+                   MakeTimeChecker ())
     .AddTraceSource ("UnackSequence",
                      "First unacknowledged sequence number (SND.UNA)",
                      MakeTraceSourceAccessor (&TcpTxBuffer::m_firstByteSeq),
                      "ns3::SequenceNumber32TracedValueCallback")
+    .AddTraceSource ("RetransOut",
+                     "Number of retransmitted segments not acknowledged yet",
+                     MakeTraceSourceAccessor (&TcpTxBuffer::m_retransOut),
+                     "ns3::TracedValueCallback::Uint32")
+    .AddTraceSource ("EntanglementBlocked",
+                     "True while the sender stalls because no entanglement "
+                     "is available and a message list is drained. Sampled "
+                     "at the events of this buffer only: the pairs "
+                     "generated by the pool or deposited by another buffer "
+                     "show when this buffer next changes",
+                     MakeTraceSourceAccessor (&TcpTxBuffer::m_entanglementBlocked),
+                     "ns3::TracedValueCallback::Bool")
+    .AddTraceSource ("QedAhead",
+                     "Number of QED records transmitted ahead of their SEND",
+                     MakeTraceSourceAccessor (&TcpTxBuffer::m_qedAhead),
+                     "ns3::TracedValueCallback::Uint32")
   ;
   return tid;
 }
@@ -120,12 +239,20 @@ TcpTxBuffer::GetTypeId (void)
  * initialized below is insignificant.
  */
 TcpTxBuffer::TcpTxBuffer (uint32_t n)
-  : m_maxBuffer (32768), m_size (0), m_sentSize (0),m_appsentSize(0), m_stageSize(0),m_stagesentSize(0),m_stage(1),m_sendQseq(0), m_stageQseq(0),m_esQseq(0),m_qednum(0),m_appnum(0),m_qheader(0),m_red(0),m_firstByteSeq (n)
+  : m_maxBuffer (32768), m_size (0), m_sentSize (0),m_appsentSize(0), m_stageSize(0),m_stagesentSize(0),m_stage(1),m_sendQseq(0), m_stageQseq(0),m_appnum(0),m_qheader(0),m_red(0),m_firstByteSeq (n),
+    m_sackedOut (0), m_pipe (0), m_lostBoundary (n), m_dupThresh (3), m_segmentSize (0),
+    m_retransOut (0), m_retransBytes (0), m_lazyFraming (false),
+    m_qedLookahead (0), m_qedAhead (0),
+    m_depositor (EntanglementPool::NO_DEPOSITOR),
+    m_lifetime (Seconds (0)), m_expiredPending (0),
+    m_qedLossPolicy (QED_REGENERATE),
+    m_eligibility (0), m_entanglementBlocked (false)
 {
 }
 
 TcpTxBuffer::~TcpTxBuffer (void)
 {
+  NS_LOG_INFO ("Item allocations avoided: " << m_itemPool.GetAllocationsAvoided ());
   PacketList::iterator it;
 
   for (it = m_sentList.begin (); it != m_sentList.end (); ++it)
@@ -141,21 +268,21 @@ m_stagesentSize -= item->m_packet->GetSize ();
 {
     m_appsentSize -= item->m_packet->GetSize ();
 }
-      delete item;
+      m_itemPool.Release (item);
     }
 
   for (it = m_appList.begin (); it != m_appList.end (); ++it)
     {
       TcpTxItem *item = *it;
-      m_size -= item->m_packet->GetSize ();
-      delete item;
+      m_size -= item->GetSeqSize ();
+      m_itemPool.Release (item);
     }
 
   for (it = m_qidList.begin (); it != m_qidList.end (); ++it)
     {
       TcpTxItem *item = *it;
-      m_stageSize -= item->m_packet->GetSize ();
-      delete item;
+      m_stageSize -= item->GetSeqSize ();
+      m_itemPool.Release (item);
     }
 }
 
@@ -199,7 +326,7 @@ TcpTxBuffer::AppsentSize (void) const
 uint32_t
 TcpTxBuffer::qidnum (void) const
 {
-  return m_qednum; //
+  return m_pool == 0 ? 0 : m_pool->GetAvailable ();
 }
 uint32_t
 TcpTxBuffer::appnum (void) const
@@ -211,6 +338,68 @@ TcpTxBuffer::qideable (void) const
 {
   return m_stage; //
 }
+
+uint32_t
+TcpTxBuffer::GetQedAhead (void) const
+{
+  return m_qedAhead;
+}
+
+bool
+TcpTxBuffer::IsQedLookaheadFull (void) const
+{
+  return m_qedLookahead > 0 && qidnum () == 0 && m_qedAhead >= m_qedLookahead;
+}
+void
+TcpTxBuffer::ReclaimExpired (void)
+{
+  NS_LOG_FUNCTION (this);
+  if (m_pool == 0)
+    {
+      return;
+    }
+
+  // The QEDs of these pairs are no longer ahead of their SEND, and neither
+  // are the ones whose pair another buffer of a shared pool took: both are
+  // regenerated for the SENDs still waiting
+  uint32_t lost = m_pool->Reclaim (GetDepositor ()) + m_pool->CollectTaken (GetDepositor ());
+  ReleaseQedAhead (lost);
+  m_expiredPending += lost;
+  while (m_expiredPending > 0)
+    {
+      if (m_appList.empty ())
+        {
+          // No SEND is waiting for the pairs that were lost
+          m_expiredPending = 0;
+          break;
+        }
+
+      uint32_t bodySize = m_appList.back ()->GetSeqSize () - m_qheader;
+      uint8_t redundancy = std::min<uint32_t> (m_red, bodySize);
+
+      // Same body as the QEDs regenerated by Addqednew
+      m_encodeBuffer.assign (bodySize, 1);
+      Ptr<Packet> q = EncodeBody (bodySize - redundancy, redundancy);
+      if (q->GetSize () + m_qheader + m_red > Available ())
+        {
+          break;
+        }
+      // Next in line, so that the pair is back before the SENDs stall
+      QueueQed (q, true);
+      NS_LOG_LOGIC ("Regenerated the QED of a decohered entanglement");
+      m_stageQseq += 1;
+      --m_expiredPending;
+    }
+  // The pool lost pairs even if no QED was regenerated
+  UpdateEligibility ();
+}
+
+Time
+TcpTxBuffer::GetExpiry (void) const
+{
+  return m_lifetime.IsStrictlyPositive () ? Simulator::Now () + m_lifetime : Time::Max ();
+}
+
 uint32_t
 TcpTxBuffer::MaxBufferSize (void) const
 {
@@ -223,6 +412,104 @@ TcpTxBuffer::SetMaxBufferSize (uint32_t n)
   m_maxBuffer = n;
 }
 
+void
+TcpTxBuffer::SetDupAckThresh (uint32_t dupAckThresh)
+{
+  NS_LOG_FUNCTION (this << dupAckThresh);
+  m_dupThresh = dupAckThresh;
+  RecomputeScoreboard ();
+}
+
+void
+TcpTxBuffer::SetSegmentSize (uint32_t segmentSize)
+{
+  NS_LOG_FUNCTION (this << segmentSize);
+  m_segmentSize = segmentSize;
+  RecomputeScoreboard ();
+}
+
+void
+TcpTxBuffer::SetQedLossPolicy (QedLossPolicy policy)
+{
+  NS_LOG_FUNCTION (this << policy);
+  m_qedLossPolicy = policy;
+}
+
+TcpTxBuffer::QedLossPolicy
+TcpTxBuffer::GetQedLossPolicy (void) const
+{
+  return m_qedLossPolicy;
+}
+
+void
+TcpTxBuffer::SetRedundancy (uint8_t red)
+{
+  NS_LOG_FUNCTION (this << static_cast<uint32_t> (red));
+  m_red = red;
+}
+
+uint8_t
+TcpTxBuffer::GetRedundancy (void) const
+{
+  return m_red;
+}
+
+void
+TcpTxBuffer::UpdateEligibility (void)
+{
+  uint8_t eligibility = 0;
+  if (m_stageSize > m_stagesentSize)
+    {
+      eligibility |= QED_UNSENT;
+    }
+  else if (m_stageSize > 0)
+    {
+      eligibility |= QED_DRAINED;
+    }
+  if (m_size > m_appsentSize)
+    {
+      eligibility |= SEND_UNSENT;
+    }
+  else if (m_size > 0)
+    {
+      eligibility |= SEND_DRAINED;
+    }
+  m_eligibility = eligibility;
+  // Every Deposit and Consume of the buffer is followed by this update; the
+  // pool does not report the pairs it generates or gets from other buffers
+  m_entanglementBlocked = IsBlockedOnEntanglement ();
+}
+
+bool
+TcpTxBuffer::IsBlockedOnEntanglement (void) const
+{
+  return (m_eligibility & (QED_DRAINED | SEND_DRAINED)) && qidnum () == 0;
+}
+
+bool
+TcpTxBuffer::IsSendStarved (void) const
+{
+  return (m_eligibility & SEND_UNSENT) && !(m_eligibility & QED_UNSENT) && qidnum () == 0;
+}
+
+bool
+TcpTxBuffer::IsWaitingForEntanglement (void) const
+{
+  return m_eligibility != (QED_UNSENT | SEND_UNSENT) && Size () > 0 && qidnum () == 0;
+}
+
+bool
+TcpTxBuffer::IsHeadQed (void) const
+{
+  return !m_sentList.empty () && m_sentList.front ()->m_qided;
+}
+
+uint64_t
+TcpTxBuffer::GetItemAllocationsAvoided (void) const
+{
+  return m_itemPool.GetAllocationsAvoided ();
+}
+
 
 uint32_t
 TcpTxBuffer::Available (void) const
@@ -239,22 +526,122 @@ TcpTxBuffer::SetHeadSequence (const SequenceNumber32& seq)
   // if you change the head with data already sent, something bad will happen
   NS_ASSERT (m_sentList.size () == 0);
   m_highestSack = std::make_pair (m_sentList.end (), SequenceNumber32 (0));
+  m_sackedOut = 0;
+  m_pipe = 0;
+  m_lostBoundary = seq;
 }
+
 void
-TcpTxBuffer::Encode(Ptr<Packet> p,Ptr<Packet> q)
-{//Immitation adding redundancy in QED.
-uint32_t packnum33;
-packnum33=q->GetSize ();
-uint8_t aaa[packnum33]={0},bbb[packnum33]={0};
-p->CopyData(bbb,packnum33);
-for(uint32_t i=0;i<packnum33;i++)
+TcpTxBuffer::SetEncoder (Ptr<QtcpEncoder> encoder)
 {
-aaa[i]=49;
-bbb[i]=bbb[i]+aaa[i];
+  NS_LOG_FUNCTION (this << encoder);
+  m_encoder = encoder;
 }
-Ptr<Packet> it = Create<Packet> (bbb,packnum33);
-*q=*it;
-//return true;
+
+Ptr<QtcpEncoder>
+TcpTxBuffer::GetEncoder (void)
+{
+  if (m_encoder == 0)
+    {
+      ObjectFactory factory;
+      factory.SetTypeId (m_encoderType);
+      m_encoder = factory.Create<QtcpEncoder> ();
+      NS_LOG_LOGIC ("Created encoder " << m_encoder->GetName ());
+    }
+  return m_encoder;
+}
+
+void
+TcpTxBuffer::SetEntanglementPool (Ptr<EntanglementPool> pool)
+{
+  NS_LOG_FUNCTION (this << pool);
+  m_pool = pool;
+  m_depositor = EntanglementPool::NO_DEPOSITOR;
+}
+
+Ptr<EntanglementPool>
+TcpTxBuffer::GetEntanglementPool (void)
+{
+  if (m_pool == 0)
+    {
+      m_pool = CreateObject<EntanglementPool> ();
+    }
+  return m_pool;
+}
+
+uint32_t
+TcpTxBuffer::GetDepositor (void)
+{
+  if (m_depositor == EntanglementPool::NO_DEPOSITOR)
+    {
+      m_depositor = GetEntanglementPool ()->AddDepositor ();
+    }
+  return m_depositor;
+}
+
+void
+TcpTxBuffer::RefundPair (TcpTxItem *item)
+{
+  NS_LOG_FUNCTION (this << item);
+  NS_ASSERT (!item->m_qided);
+  if (item->m_pairs > 0)
+    {
+      // The pair keeps the time it decoheres: an expired one is reclaimed.
+      // Once stored, it is ahead of a SEND of this buffer again; a pair the
+      // pool has no room for is regenerated like a decohered one.
+      uint32_t stored = GetEntanglementPool ()->Deposit (item->m_pairs, item->m_expiry,
+                                                         GetDepositor ());
+      m_qedAhead = m_qedAhead + stored;
+      m_expiredPending += item->m_pairs - stored;
+    }
+  item->m_expiry = Time::Max ();
+  item->m_pairs = 0;
+}
+
+void
+TcpTxBuffer::ReleaseQedAhead (uint32_t pairs)
+{
+  NS_LOG_FUNCTION (this << pairs);
+  NS_ASSERT_MSG (m_qedAhead >= pairs, "QedAhead underflow: " << m_qedAhead
+                 << " pairs counted, releasing " << pairs);
+  m_qedAhead = m_qedAhead - pairs;
+}
+
+Ptr<Packet>
+TcpTxBuffer::Encode (Ptr<const Packet> p)
+{
+  return Encode (p, m_red);
+}
+
+Ptr<Packet>
+TcpTxBuffer::Encode (Ptr<const Packet> p, uint32_t redundancy)
+{
+  NS_LOG_FUNCTION (this << p << redundancy);
+  uint32_t payloadSize = p->GetSize ();
+
+  m_encodeBuffer.resize (payloadSize + redundancy);
+  if (payloadSize > 0)
+    {
+      p->CopyData (&m_encodeBuffer[0], payloadSize);
+    }
+  std::fill (m_encodeBuffer.begin () + payloadSize, m_encodeBuffer.end (), 0);
+
+  return EncodeBody (payloadSize, redundancy);
+}
+
+Ptr<Packet>
+TcpTxBuffer::EncodeBody (uint32_t payloadSize, uint32_t redundancy)
+{
+  NS_LOG_FUNCTION (this << payloadSize << redundancy);
+  NS_ASSERT (m_encodeBuffer.size () == payloadSize + redundancy);
+
+  if (m_encodeBuffer.empty ())
+    {
+      return Create<Packet> ();
+    }
+
+  GetEncoder ()->Encode (&m_encodeBuffer[0], payloadSize, redundancy);
+  return Create<Packet> (&m_encodeBuffer[0], m_encodeBuffer.size ());
 }
 /*
 bool
@@ -273,20 +660,13 @@ return it;
 bool
 TcpTxBuffer::Add (Ptr<Packet> p)
 {
-if(m_esQseq==0){m_esQseq=rand ();}
+if (m_lazyFraming)
+  {
+    return AddLazy (p);
+  }
 if(5*(p->GetSize ()+m_qheader+m_red) <= Available ())//
 {
-m_appnum++;
-uint32_t packnum11;
-packnum11=p->GetSize ();
-uint8_t ccc[packnum11]={0};
-Ptr<Packet> q=Create<Packet> (ccc,packnum11+m_red);
-Encode(p,q); 
-Addqed(q);
-Addapp(p);
-m_sendQseq+=1;
-m_stageQseq+=1;
-m_esQseq+=1;
+QueueMessage (p);
  return true;
 }
 
@@ -294,76 +674,229 @@ return false;
  
 }
 
+uint32_t
+TcpTxBuffer::AddBatch (const std::vector<Ptr<Packet> > &packets)
+{
+  NS_LOG_FUNCTION (this << packets.size ());
+
+  // One capacity check for the whole batch: admit the longest prefix that
+  // fits, each packet with the rule of Add ()
+  uint32_t available = Available ();
+  uint32_t admitted = 0;
+  for (; admitted < packets.size (); ++admitted)
+    {
+      Ptr<const Packet> p = packets[admitted];
+      uint32_t needed = GetRecordsSize (p);
+      uint32_t required = m_lazyFraming ? needed : 5 * (p->GetSize () + m_qheader + m_red);
+      if (required > available)
+        {
+          break;
+        }
+      available -= needed;
+    }
+
+  // The records get contiguous sequence numbers
+  for (uint32_t i = 0; i < admitted; ++i)
+    {
+      if (m_lazyFraming)
+        {
+          QueueLazy (packets[i]);
+        }
+      else
+        {
+          QueueMessage (packets[i]);
+        }
+    }
+
+  NS_LOG_INFO ("Queued " << admitted << " of " << packets.size () <<
+               " packets, size=" << m_size << " qidsize=" << m_stageSize);
+  return admitted;
+}
+
+uint32_t
+TcpTxBuffer::GetRecordsSize (Ptr<const Packet> p) const
+{
+  // Both records take header, payload and redundancy; an empty payload
+  // still gets its QED (the redundancy alone), but no SEND
+  uint32_t record = m_qheader + p->GetSize () + m_red;
+  return (p->GetSize () + m_red > 0 ? record : 0) + (p->GetSize () > 0 ? record : 0);
+}
+
+void
+TcpTxBuffer::QueueMessage (Ptr<Packet> p)
+{
+  m_appnum++;
+  NS_ASSERT_MSG (p->GetSize () <= 0xffff, "QTCP message longer than the header can describe");
+  Ptr<Packet> q = Encode (p);
+  QueueQed (q);
+  QueueApp (p);
+  m_sendQseq += 1;
+  m_stageQseq += 1;
+}
+
 
 
 bool
-TcpTxBuffer::Addapp (Ptr<Packet> p)
+TcpTxBuffer::AddLazy (Ptr<Packet> p)
 {
+  NS_LOG_FUNCTION (this << p);
+
+  if (GetRecordsSize (p) > Available ())
+    {
+      NS_LOG_WARN ("Rejected. Not enough room to buffer packet.");
+      return false;
+    }
 
+  QueueLazy (p);
+  return true;
+}
 
-//Addqed(p);
+void
+TcpTxBuffer::QueueLazy (Ptr<Packet> p)
+{
+  NS_ASSERT_MSG (p->GetSize () <= 0xffff, "QTCP message longer than the header can describe");
 
+  uint32_t record = m_qheader + p->GetSize () + m_red;
+  bool qed = p->GetSize () + m_red > 0;
+  bool send = p->GetSize () > 0;
+
+  // The caller keeps its packet: both records share one copy of it, which
+  // only shares the application buffer
+  Ptr<Packet> payload = p->Copy ();
+
+  m_appnum++;
+
+  if (qed)
+    {
+      TcpTxItem *item = m_itemPool.Allocate ();
+      item->m_qided = true;
+      item->m_framed = false;
+      item->m_packet = payload;
+      item->m_header.SetMessageType (QtcpHeader::QED);
+      item->m_header.SetEsQseq (GetEntanglementPool ()->AllocateEsQseq ());
+      item->m_header.SetStageQseq (m_stageQseq);
+      item->m_header.SetHeaderLength (m_qheader);
+      item->m_header.SetPayloadLength (p->GetSize ());
+      item->m_header.SetRedundancyLength (m_red);
+      m_qidList.insert (m_qidList.end (), item);
+      m_stageSize += record;
+    }
+
+  if (send)
+    {
+      TcpTxItem *item = m_itemPool.Allocate ();
+      item->m_qided = false;
+      item->m_framed = false;
+      item->m_packet = payload;
+      item->m_header.SetMessageType (QtcpHeader::SEND);
+      item->m_header.SetStageQseq (m_stageQseq);
+      item->m_header.SetSendQseq (m_sendQseq);
+      item->m_header.SetHeaderLength (m_qheader);
+      item->m_header.SetPayloadLength (p->GetSize ());
+      item->m_header.SetRedundancyLength (m_red);
+      m_appList.insert (m_appList.end (), item);
+      m_size += record;
+    }
+
+  NS_LOG_INFO ("Queued " << GetRecordsSize (p) << " bytes, size=" << m_size <<
+               " qidsize=" << m_stageSize);
+
+  m_sendQseq+=1;
+  m_stageQseq+=1;
+  UpdateEligibility ();
+}
+
+void
+TcpTxBuffer::FrameItem (TcpTxItem *item)
+{
+  NS_LOG_FUNCTION (this << item);
+  NS_ASSERT (!item->m_framed);
+
+  Ptr<Packet> record;
+  if (item->m_header.GetMessageType () == QtcpHeader::QED)
+    {
+      record = Encode (item->m_packet, item->m_header.GetRedundancyLength ());
+    }
+  else
+    {
+      // The copy only shares the application buffer, no byte is copied
+      record = item->m_packet->Copy ();
+      record->AddPaddingAtEnd (item->m_header.GetRedundancyLength ());
+    }
+  record->AddHeader (item->m_header);
+
+  item->m_packet = record;
+  item->m_framed = true;
+  NS_ASSERT (item->m_packet->GetSize () == item->m_header.GetRecordLength ());
+}
+
+void
+TcpTxBuffer::FrameItems (PacketList &list, uint32_t numBytes)
+{
+  NS_LOG_FUNCTION (this << numBytes);
+
+  uint32_t framed = 0;
+  PacketList::iterator it;
+  for (it = list.begin (); it != list.end () && framed < numBytes; ++it)
+    {
+      if (!(*it)->m_framed)
+        {
+          FrameItem (*it);
+        }
+      framed += (*it)->m_packet->GetSize ();
+    }
+}
+
+bool
+TcpTxBuffer::Addapp (Ptr<Packet> p)
+{
   NS_LOG_FUNCTION (this << p);
+//Addqed(p);
+
   NS_LOG_INFO ("Try to append" << p->GetSize () << " bytes to window starting at "
                                 << m_firstByteSeq << ", availSize=" << Available ());
 
   if (p->GetSize ()+m_qheader+m_red <= Available ())
     {
-    
-if (p->GetSize () > 0)
-        {
-          
-        TcpTxItem *item = new TcpTxItem ();
-item->m_qided=false;
-uint32_t packnum,lsnum;
-packnum=p->GetSize ()+m_qheader+m_red;
-
-uint8_t packet1[packnum]={0};
-
-lsnum=m_stageQseq;
-	    packet1[0]='Q';
-	    packet1[1]='T';
-	    packet1[2]='C';
-            packet1[3]='S';
-	    packet1[4]=lsnum>>24;//m_qidsum>>24;
-	    packet1[5]=lsnum>>16;//m_qidsum>>16;
-	    packet1[6]=lsnum>>8;//m_qidsum>>8;
-	    packet1[7]=lsnum>>0;//m_qidsum;
-lsnum=m_sendQseq;
-	    packet1[8]=lsnum>>24;//m_sendQseq>>24;
-	    packet1[9]=lsnum>>16;//m_sendQseq>>16;
-	    packet1[10]=lsnum>>8;//m_sendQseq>>8;
-	    packet1[11]=lsnum>>0;//m_sendQseq;
-
-	    packet1[12]=128+64+m_qheader/4;
-
-            packet1[13]=0;
-            packet1[14]=0;
-            packet1[15]=0;
-
-	       // Ptr<Packet> packet1 = Create<Packet> (12);
-
-	       Ptr<Packet> it = Create<Packet> (packet1,m_qheader);
-
-	    //   Ptr<Packet> pqid = Create<Packet> (packet1,12);
-uint8_t packet2[packnum]={0};
-               Ptr<Packet> appn = Create<Packet> (packet2,m_red);
-it->AddAtEnd(p);
-it->AddAtEnd(appn);
-
-        //item->m_qided=false;
-          item->m_packet = it->Copy ();
-          m_appList.insert (m_appList.end (), item);
-          m_size += it->GetSize ();
-
-          NS_LOG_INFO ("Updated size=" << m_size  << ", lastSeq=" <<
-                       m_firstByteSeq + SequenceNumber32 (m_size)+SequenceNumber32 (m_stageSize));
-        }
+      QueueApp (p);
       return true;
     }
   NS_LOG_WARN ("Rejected. Not enough room to buffer packet.");
   return false;
 }
+
+void
+TcpTxBuffer::QueueApp (Ptr<Packet> p)
+{
+  if (p->GetSize () > 0)
+    {
+      TcpTxItem *item = m_itemPool.Allocate ();
+      item->m_qided = false;
+
+      QtcpHeader header;
+      header.SetMessageType (QtcpHeader::SEND);
+      header.SetStageQseq (m_stageQseq);
+      header.SetSendQseq (m_sendQseq);
+      header.SetHeaderLength (m_qheader);
+      header.SetPayloadLength (p->GetSize ());
+      header.SetRedundancyLength (m_red);
+
+      // SEND: header, the data as is, and zeroed redundancy. The copy only
+      // shares the application buffer, no byte is copied.
+      Ptr<Packet> send = p->Copy ();
+      send->AddPaddingAtEnd (m_red);
+      send->AddHeader (header);
+
+      item->m_packet = send;
+      m_appList.insert (m_appList.end (), item);
+      m_size += send->GetSize ();
+
+      NS_LOG_INFO ("Updated size=" << m_size  << ", lastSeq=" <<
+                   m_firstByteSeq + SequenceNumber32 (m_size)+SequenceNumber32 (m_stageSize));
+      UpdateEligibility ();
+    }
+}
+
 bool
 TcpTxBuffer::Addqed (Ptr<Packet> p)
 {
@@ -375,57 +908,44 @@ TcpTxBuffer::Addqed (Ptr<Packet> p)
 
   if (p->GetSize ()+m_qheader+m_red <= Available ())
     {
-      if (p->GetSize () > 0)
-        {
-          TcpTxItem *item = new TcpTxItem ();
-item->m_qided=true;
-uint32_t lsnum;
-
-
-uint8_t packet1[m_qheader]={0};
-
-
-            packet1[0]='Q';//QTCP
-	    packet1[1]='T';
-	    packet1[2]='C';//CheckSum
-            packet1[3]='S';
-lsnum=m_esQseq;
-	    packet1[4]=lsnum>>24;//m_qidsum>>24;
-	    packet1[5]=lsnum>>16;//m_qidsum>>16;
-	    packet1[6]=lsnum>>8;//m_qidsum>>8;
-	    packet1[7]=lsnum>>0;//m_qidsum;
-
-lsnum=m_stageQseq;
-	    packet1[8]=lsnum>>24;//m_qidsum>>24;
-	    packet1[9]=lsnum>>16;//m_qidsum>>16;
-	    packet1[10]=lsnum>>8;//m_qidsum>>8;
-	    packet1[11]=lsnum>>0;//m_qidsum;
-	    
-	   
-	    packet1[12]=128+m_qheader/4;
-            packet1[13]=0;
-            packet1[14]=0;
-            packet1[15]=0;
-	    Ptr<Packet> pqid = Create<Packet> (packet1,m_qheader);
-            pqid->AddAtEnd(p);
-
-
-
-
-
-          item->m_packet = pqid->Copy();
-
-          m_qidList.insert (m_qidList.end (), item);
-          m_stageSize += pqid->GetSize ();
-
-          NS_LOG_INFO ("Updated qidsize=" << m_stageSize  << ", lastSeq=" <<
-                       m_firstByteSeq + SequenceNumber32 (m_size)+SequenceNumber32 (m_stageSize));
-        }
+      QueueQed (p);
       return true;
     }
   NS_LOG_WARN ("Rejected. Not enough room to buffer packet.");
   return false;
 }
+
+void
+TcpTxBuffer::QueueQed (Ptr<Packet> p, bool atHead)
+{
+  if (p->GetSize () > 0)
+    {
+      TcpTxItem *item = m_itemPool.Allocate ();
+      item->m_qided = true;
+
+      // p is the encoded body (payload and redundancy) built by Add, and
+      // it is owned by the buffer: frame it in place.
+      uint8_t redundancy = std::min<uint32_t> (m_red, p->GetSize ());
+      QtcpHeader header;
+      header.SetMessageType (QtcpHeader::QED);
+      header.SetEsQseq (GetEntanglementPool ()->AllocateEsQseq ());
+      header.SetStageQseq (m_stageQseq);
+      header.SetHeaderLength (m_qheader);
+      header.SetPayloadLength (p->GetSize () - redundancy);
+      header.SetRedundancyLength (redundancy);
+      p->AddHeader (header);
+
+      item->m_packet = p;
+
+      m_qidList.insert (atHead ? m_qidList.begin () : m_qidList.end (), item);
+      m_stageSize += p->GetSize ();
+
+      NS_LOG_INFO ("Updated qidsize=" << m_stageSize  << ", lastSeq=" <<
+                   m_firstByteSeq + SequenceNumber32 (m_size)+SequenceNumber32 (m_stageSize));
+      UpdateEligibility ();
+    }
+}
+
 bool
 TcpTxBuffer::Addqednew (TcpTxItem *p)//TcpTxItem *item //Ptr<Packet> p
 {
@@ -434,57 +954,25 @@ TcpTxBuffer::Addqednew (TcpTxItem *p)//TcpTxItem *item //Ptr<Packet> p
 
       if (p->m_packet->GetSize () > 0)
         {
-          TcpTxItem *item = new TcpTxItem ();
-item->m_qided=true;
-uint32_t packnum,lsnum;
-packnum=p->m_packet->GetSize ();
-uint8_t packet1[packnum]={0};
-
-lsnum=m_esQseq;
-	    packet1[0]='Q';
-	    packet1[1]='T';
-	    packet1[2]='C';
-            packet1[3]='S';
-
-	    packet1[4]=lsnum>>24;//m_qidsum>>24;
-	    packet1[5]=lsnum>>16;//m_qidsum>>16;
-	    packet1[6]=lsnum>>8;//m_qidsum>>8;
-	    packet1[7]=lsnum>>0;//m_qidsum;
-
-lsnum=m_stageQseq;
-	    packet1[8]=lsnum>>24;//m_qidsum>>24;
-	    packet1[9]=lsnum>>16;//m_qidsum>>16;
-	    packet1[10]=lsnum>>8;//m_qidsum>>8;
-	    packet1[11]=lsnum>>0;//m_qidsum;
-	    
-	   
-	    packet1[12]=128+m_qheader/4;;
-
-            packet1[13]=0;
-            packet1[14]=0;
-            packet1[15]=0;
-
-m_esQseq+=1;
+          uint32_t packnum = p->m_packet->GetSize ();
+          NS_ASSERT (packnum >= m_qheader);
+          uint32_t bodySize = packnum - m_qheader;
+          uint8_t redundancy = std::min<uint32_t> (m_red, bodySize);
+
+          QtcpHeader header;
+          header.SetMessageType (QtcpHeader::QED);
+          header.SetEsQseq (GetEntanglementPool ()->AllocateEsQseq ());
+          header.SetStageQseq (m_stageQseq);
+          header.SetHeaderLength (m_qheader);
+          header.SetPayloadLength (bodySize - redundancy);
+          header.SetRedundancyLength (redundancy);
+
 m_stageQseq+=1;
-	       // Ptr<Packet> packet1 = Create<Packet> (12);
-               Ptr<Packet> pqid = Create<Packet> (packet1,m_qheader);
-uint8_t packet2[packnum-m_qheader]={0};
-for(uint32_t i=0;i<packnum-m_qheader;i++)
-{
-packet2[i]=1;
-}
-	       Ptr<Packet> pqidp = Create<Packet> (packet2,packnum-m_qheader);
-uint8_t packet3[packnum-m_qheader]={0};
-                Ptr<Packet> pqidq = Create<Packet> (packet3,packnum-m_qheader);
-Encode(pqidp,pqidq);
-pqid->AddAtEnd(pqidq);
-            item->m_packet = pqid->Copy ();
-//packet->RemoveAtEnd(24);// clear APP head 12
-p->m_packet->RemoveAtStart(packnum);//clear APP end 24
-            p->m_packet=pqid->Copy ();
-        //  m_qidList.push_front (item);
-      //    m_sentList.insert (m_sentList.end (), item);
-        //  m_stageSize += pqid->GetSize ();
+          // The regenerated body is made of ones, redundancy area included
+          m_encodeBuffer.assign (bodySize, 1);
+          Ptr<Packet> pqidq = EncodeBody (bodySize - redundancy, redundancy);
+          pqidq->AddHeader (header);
+          p->m_packet = pqidq;
 
      }
       return true;
@@ -513,10 +1001,95 @@ TcpTxBuffer::CopyFromSequence (uint32_t numBytes, const SequenceNumber32& seq)
 {
   NS_LOG_FUNCTION (this << numBytes << seq);
 
+  TcpTxItem *outItem = ReserveSegment (numBytes, seq);
+  if (outItem == 0)
+    {
+      return Create<Packet> ();
+    }
+  return TransmitItem (outItem);
+}
+
+uint32_t
+TcpTxBuffer::Reserve (uint32_t numBytes, const SequenceNumber32& seq)
+{
+  NS_LOG_FUNCTION (this << numBytes << seq);
+
+  TcpTxItem *outItem = ReserveSegment (numBytes, seq);
+  return outItem == 0 ? 0 : outItem->m_packet->GetSize ();
+}
+
+Ptr<Packet>
+TcpTxBuffer::CopyReserved (uint32_t numBytes, SequenceNumber32& seq)
+{
+  NS_LOG_FUNCTION (this << numBytes << seq);
+
+  if (numBytes == 0)
+    {
+      return Create<Packet> ();
+    }
+  if (m_firstByteSeq >= seq + numBytes)
+    {
+      // A reserved retransmission acknowledged while it waited
+      NS_LOG_LOGIC ("Reserved block " << seq << " already acknowledged");
+      return Create<Packet> ();
+    }
+  if (m_firstByteSeq > seq)
+    {
+      // Only its head has been acknowledged: transmit the remainder
+      NS_LOG_LOGIC ("Reserved block " << seq << " acknowledged up to " << m_firstByteSeq);
+      numBytes -= m_firstByteSeq - seq;
+      seq = m_firstByteSeq;
+    }
+
+  // The reservation is the item starting at seq, unless the SentList has been
+  // edited since (e.g. a SACK split or an RTO reset)
+  TcpTxItem *item;
+  SentIndex::iterator idx = m_sentIndex.find (seq);
+  if (idx != m_sentIndex.end () && (*idx->second)->m_packet->GetSize () == numBytes)
+    {
+      item = *idx->second;
+    }
+  else
+    {
+      SequenceNumber32 highData = m_firstByteSeq + m_sentSize;
+      if (highData <= seq)
+        {
+          return Create<Packet> ();
+        }
+      item = GetTransmittedSegment (std::min<uint32_t> (numBytes, highData - seq), seq);
+      NS_ASSERT (item != 0);
+
+      // The edit may have marked it lost: it is in flight again, as after
+      // ReserveSegment
+      m_pipe -= PipeContribution (item, seq, m_lostBoundary);
+      item->m_lost = false;
+      m_pipe += PipeContribution (item, seq, m_lostBoundary);
+    }
+
+  return TransmitItem (item);
+}
+
+Ptr<Packet>
+TcpTxBuffer::TransmitItem (TcpTxItem *item)
+{
+  item->m_lastSent = Simulator::Now ();
+  if (item->m_qided)
+    {
+      // The memory holding the entanglement starts decohering now
+      item->m_expiry = GetExpiry ();
+    }
+  return item->m_packet->Copy ();
+}
+
+TcpTxItem*
+TcpTxBuffer::ReserveSegment (uint32_t numBytes, const SequenceNumber32& seq)
+{
+  NS_LOG_FUNCTION (this << numBytes << seq);
+
   if (m_firstByteSeq > seq)
     {
       NS_LOG_ERROR ("Requested a sequence number which is not in the buffer anymore");
-      return Create<Packet> ();
+      return 0;
     }
 
   // Real size to extract. Insure not beyond end of data
@@ -528,11 +1101,11 @@ uint32_t s3=std::min (s, m_size-m_appsentSize);
 
 NS_LOG_INFO ("start   S1="<<s1<<"    S3="<<s3<<"  S="<<s);
 
-NS_LOG_INFO ("m_stage= "<<m_stage<<" m_qednum="<<m_qednum<<" m_appnum="<<m_appnum);
+NS_LOG_INFO ("m_stage= "<<m_stage<<" pairs="<<qidnum ()<<" m_appnum="<<m_appnum);
 
 if (s == 0)
     {
-      return Create<Packet> ();
+      return 0;
     }
 
   TcpTxItem *outItem = 0;
@@ -543,8 +1116,12 @@ if (s == 0)
      outItem = GetTransmittedSegment (s, seq);
      NS_ASSERT (outItem != 0);
 
-    
-     outItem->m_retrans = true;
+     m_pipe -= PipeContribution (outItem, seq, m_lostBoundary);
+     if (!outItem->m_retrans)
+       {
+         outItem->m_retrans = true;
+         AddRetransmit (outItem);
+       }
      NS_LOG_INFO (" outItem->m_retrans= "<<outItem->m_retrans<<"  outItem->m_qided= "<<outItem->m_retrans<<" outItem "<< outItem);
      NS_LOG_DEBUG ("Retransmitting11 [" << seq << ";" << seq + s << "|" << s <<
                     "] from " << *this);
@@ -552,7 +1129,23 @@ if (s == 0)
   else 
 {
 
-if(m_qednum>0)
+// A pool that generates pairs by itself can hold some while no SEND is
+// waiting: the QEDs go out then
+bool sendQed = (qidnum () == 0 || s3 == 0);
+if (m_qedLookahead > 0 && !sendQed)
+  {
+    // Pipelined: keep up to m_qedLookahead QEDs ahead of their SEND, so that
+    // the entanglements are ready when the SENDs reach the head
+    sendQed = (s1 > 0 && m_qedAhead < m_qedLookahead);
+  }
+if (sendQed && s1 == 0)
+  {
+    // No pair and no QED to establish one: the SEND waits for the QED that
+    // ReclaimExpired regenerates
+    NS_LOG_LOGIC ("No entanglement and no QED to transmit");
+    return 0;
+  }
+if(!sendQed)
 {
 m_stage=0;
 s=s3;
@@ -573,6 +1166,7 @@ if (m_firstByteSeq + m_sentSize <= seq)
       outItem = GetNewSegment (s);
       NS_ASSERT (outItem != 0);
       NS_ASSERT (outItem->m_retrans == false);
+      m_pipe -= PipeContribution (outItem, seq, m_lostBoundary);
 
       NS_LOG_DEBUG ("New segment [" << seq << ";" << seq + s << "|" << s <<
                     "] from " << *this);
@@ -592,18 +1186,16 @@ if (m_firstByteSeq + m_sentSize <= seq)
       NS_ASSERT (outItem != 0);
 
       // Now get outItem from the sent list (there will be a merge)
-      return CopyFromSequence (numBytes, seq);
+      return ReserveSegment (numBytes, seq);
     }
 }
   outItem->m_lost = false;
-  outItem->m_lastSent = Simulator::Now ();
-
-  Ptr<Packet> toRet = outItem->m_packet->Copy ();
+  m_pipe += PipeContribution (outItem, seq, m_lostBoundary);
 
-  NS_LOG_INFO ("toRet->GetSize ()== "<<toRet->GetSize ()<<"  S== "<<s);
-  NS_ASSERT (toRet->GetSize () == s);
+  NS_LOG_INFO ("outItem->m_packet->GetSize ()== "<<outItem->m_packet->GetSize ()<<"  S== "<<s);
+  NS_ASSERT (outItem->m_packet->GetSize () == s);
 
-  return toRet;
+  return outItem;
 }
 
 TcpTxItem*
@@ -617,16 +1209,14 @@ if(m_stage==1 )//m_stage==1&&
 NS_LOG_INFO ("qid m_firstByteSeq="<<m_firstByteSeq<<" m_stagesentSize=" <<m_stagesentSize);
   bool listEdited = false;
 NS_LOG_INFO ("get new form qid=="<<m_stageSize<<"get new form qidsent=="<<m_stagesentSize);
-  TcpTxItem *itemqid = GetPacketFromList (m_qidList, startOfQidList,
-                                       numBytes, startOfQidList, &listEdited);
+  FrameItems (m_qidList, numBytes);
+  PacketList::iterator itqid = GetPacketFromList (m_qidList, startOfQidList,
+                                                  numBytes, startOfQidList, &listEdited);
 
   (void) listEdited;
-//NS_ASSERT (m_qednum=0);
   // Move item from qidList to SentList (should be the first, not too complex)
-  PacketList::iterator itqid = std::find (m_qidList.begin (), m_qidList.end (), itemqid);
-  NS_ASSERT (itqid != m_qidList.end ());
+  TcpTxItem *itemqid = *itqid;
 itemqid->m_qided=true;
-  m_qidList.erase (itqid);//
 
 //m_stageSize--;
 
@@ -635,14 +1225,16 @@ itemqid->m_qided=true;
 //itemqid->m_sacked=false;
 //Addqednew(itemqid->m_packet);
 //Addqednew(itemqid);
-  m_sentList.insert (m_sentList.end (), itemqid);
-  m_sentSize += itemqid->m_packet->GetSize ();
+  AppendToSentList (m_qidList, itqid);
 
   m_stagesentSize += itemqid->m_packet->GetSize ();
+  itemqid->m_pairs = 1;
+  m_qedAhead = m_qedAhead + 1;
 NS_LOG_INFO ("get new form qid=="<<m_stageSize<<"get new form qidsent=="<<m_stagesentSize);
  
 //Addqed(itemqid->m_packet);
  m_stage=0; 
+  UpdateEligibility ();
 return itemqid;
         }
 
@@ -654,27 +1246,34 @@ SequenceNumber32 startOfAppList = m_firstByteSeq + m_appsentSize ;
 NS_LOG_INFO (" app m_firstByteSeq== "<<m_firstByteSeq<<" m_appsentSize= "<<m_appsentSize);
   bool listEdited = false;
  NS_LOG_INFO (" get new form app11==  "<<m_size<<" get new form appsent==  "<<m_appsentSize);
+  FrameItems (m_appList, numBytes);
 
-  TcpTxItem *item = GetPacketFromList (m_appList, startOfAppList,
-                                       numBytes, startOfAppList, &listEdited);
+  PacketList::iterator it = GetPacketFromList (m_appList, startOfAppList,
+                                               numBytes, startOfAppList, &listEdited);
 
   (void) listEdited;
 
   // Move item from AppList to SentList (should be the first, not too complex)
-  PacketList::iterator it = std::find (m_appList.begin (), m_appList.end (), item);
-  NS_ASSERT (it != m_appList.end ());
+  TcpTxItem *item = *it;
   item->m_qided=false;
   //item->m_sacked=false;
-  m_appList.erase (it);
-  m_sentList.insert (m_sentList.end (), item);
-  m_sentSize += item->m_packet->GetSize ();
+  AppendToSentList (m_appList, it);
 
 
   m_appsentSize += item->m_packet->GetSize ();
  NS_LOG_INFO (" get new form app22== "<<m_size<<" get new form appsent== "<<m_appsentSize);
-       m_qednum-=1;
+  // Time::Min () if the pool was empty: nothing to refund
+  uint32_t owner = EntanglementPool::NO_DEPOSITOR;
+  item->m_expiry = GetEntanglementPool ()->Consume (GetDepositor (), &owner);
+  item->m_pairs = item->m_expiry != Time::Min () ? 1 : 0;
+  if (owner == GetDepositor ())
+    {
+      // Pairs of other buffers or generated ones were never counted here
+      ReleaseQedAhead (1);
+    }
 m_stage=1; 
 m_appnum--;
+  UpdateEligibility ();
 return item;
         }
   
@@ -682,6 +1281,26 @@ return item;
 
 
 
+void
+TcpTxBuffer::AppendToSentList (PacketList &list, PacketList::iterator it)
+{
+  NS_LOG_FUNCTION (this << *it);
+  TcpTxItem *item = *it;
+  SequenceNumber32 begin = m_firstByteSeq + m_sentSize;
+
+  m_sentList.splice (m_sentList.end (), list, it);
+  m_sentIndex[begin] = it;
+  m_sentSize += item->m_packet->GetSize ();
+  AddRetransmit (item);
+
+  // The item is above everything SACKed, hence above the lost boundary
+  if (item->m_sacked)
+    {
+      ++m_sackedOut;
+    }
+  m_pipe += PipeContribution (item, begin, m_lostBoundary);
+}
+
 TcpTxItem*
 TcpTxBuffer::GetTransmittedSegment (uint32_t numBytes, const SequenceNumber32 &seq)
 {
@@ -691,7 +1310,8 @@ TcpTxBuffer::GetTransmittedSegment (uint32_t numBytes, const SequenceNumber32 &s
 
   bool listEdited = false;
 
-  TcpTxItem *item = GetPacketFromList (m_sentList, m_firstByteSeq, numBytes, seq, &listEdited);
+  TcpTxItem *item = *GetPacketFromList (m_sentList, m_firstByteSeq, numBytes, seq,
+                                        &listEdited, &m_sentIndex);
  
 
  if (listEdited && m_highestSack.second >= m_firstByteSeq)
@@ -701,7 +1321,13 @@ TcpTxBuffer::GetTransmittedSegment (uint32_t numBytes, const SequenceNumber32 &s
   
      }
 
-if(item->m_qided && item->m_lost&&item->m_retrans){Addqednew(item);} 
+  if (listEdited)
+    {
+      // Split and merge may change the SACKed items
+      RecomputeScoreboard ();
+    }
+
+if(item->m_qided && item->m_lost&&item->m_retrans&&m_qedLossPolicy==QED_REGENERATE){Addqednew(item);} 
   return item;
 }
 
@@ -710,23 +1336,22 @@ TcpTxBuffer::GetHighestSacked () const
 {
   NS_LOG_FUNCTION (this);
 
-  PacketList::const_iterator it;
-  std::pair <TcpTxBuffer::PacketList::const_iterator, SequenceNumber32> ret;
-  SequenceNumber32 beginOfCurrentPacket = m_firstByteSeq;
-
-  ret = std::make_pair (m_sentList.end (), SequenceNumber32 (0));
+  // The highest SACKed item is usually close to the tail: walk the index
+  // backward and stop at the first SACKed item
+  SentIndex::const_iterator idx = m_sentIndex.end ();
 
-  for (it = m_sentList.begin (); it != m_sentList.end (); ++it)
+  while (idx != m_sentIndex.begin ())
     {
-      const TcpTxItem *item = *it;
+      --idx;
+      const TcpTxItem *item = *(idx->second);
       if (item->m_sacked)
         {
-          ret = std::make_pair (it, beginOfCurrentPacket);
+          PacketList::const_iterator next = idx->second;
+          return std::make_pair (++next, idx->first + item->m_packet->GetSize ());
         }
-      beginOfCurrentPacket += item->m_packet->GetSize ();
     }
 
-  return ret;
+  return std::make_pair (m_sentList.end (), SequenceNumber32 (0));
 }
 
 
@@ -734,20 +1359,25 @@ void
 TcpTxBuffer::SplitItems (TcpTxItem &t1, TcpTxItem &t2, uint32_t size) const
 {
   NS_LOG_FUNCTION (this << size);
+  NS_ASSERT (t2.m_framed);
   t1.m_packet = t2.m_packet->CreateFragment (0, size);
   t2.m_packet->RemoveAtStart (size);
   t1.m_qided = t2.m_qided;//qid flage
   t1.m_sacked = t2.m_sacked;
   t1.m_lastSent = t2.m_lastSent;
+  t1.m_expiry = t2.m_expiry;
+  // The pair goes with the head of the record, which is discarded first
+  t1.m_pairs = t2.m_pairs;
+  t2.m_pairs = 0;
   t1.m_retrans = t2.m_retrans;
   t1.m_lost = t2.m_lost;
 
 }
 
-TcpTxItem*
+TcpTxBuffer::PacketList::iterator
 TcpTxBuffer::GetPacketFromList (PacketList &list, const SequenceNumber32 &listStartFrom,
                                 uint32_t numBytes, const SequenceNumber32 &seq,
-                                bool *listEdited) const
+                                bool *listEdited, SentIndex *index)
 {
   NS_LOG_FUNCTION (this << numBytes << seq);
 
@@ -770,155 +1400,162 @@ TcpTxBuffer::GetPacketFromList (PacketList &list, const SequenceNumber32 &listSt
    *
    * We can have mixed case (e.g. seq over the boundary while numBytes not).
    *
-   * If we discover that we are in (2) or in a mixed case, we split
-   * packets accordingly to the requested bounds and re-run the function.
-   *
-   * In (1), things are pretty easy, it's just a matter of walking the list and
-   * defragment packets, if needed (e.g. seq is the beginning of the first packet
-   * while maxBytes is the end of some packet next in the list).
+   * The list is edited in a single forward pass: first, the packet which
+   * contains seq is found, and split if seq is in its middle. Then, the packets
+   * that follow are merged into it until it holds at least numBytes bytes.
+   * Finally, if the merged packet is longer than numBytes, its tail is split
+   * off. Therefore, the list is split at most once at each end of the request.
    */
 
-  Ptr<Packet> currentPacket = 0;
-  TcpTxItem *currentItem = 0;
-  TcpTxItem *outItem = 0;
   PacketList::iterator it = list.begin ();
   SequenceNumber32 beginOfCurrentPacket = listStartFrom;
-// NS_ASSERT (5==5);
-  
-  while (it != list.end ())
+
+  // Only the items of the SentList are in the retransmit counters
+  bool sent = (&list == &m_sentList);
+
+  if (index != 0)
+    {
+      // Jump directly to the item holding seq, instead of walking the list
+      SentIndex::iterator pos = index->upper_bound (seq);
+      if (pos != index->begin ())
+        {
+          --pos;
+          it = pos->second;
+          beginOfCurrentPacket = pos->first;
+        }
+    }
+
+  // Find the packet which contains seq
+  while (it != list.end ()
+         && seq >= beginOfCurrentPacket + (*it)->m_packet->GetSize ())
+    {
+      beginOfCurrentPacket += (*it)->m_packet->GetSize ();
+      ++it;
+    }
+
+  if (it == list.end ())
     {
-      currentItem = *it;
-      currentPacket = currentItem->m_packet;
+      NS_FATAL_ERROR ("This point is not reachable");
+    }
 
-      // The objective of this snippet is to find (or to create) the packet
-      // that begin with the sequence seq
+  TcpTxItem *outItem = *it;
 
-      if (seq < beginOfCurrentPacket + currentPacket->GetSize ())
+  if (seq > beginOfCurrentPacket)
+    {
+      // seq is inside the current packet but seq is not the beginning,
+      // it's somewhere in the middle. Fragment the beginning away.
+      NS_LOG_INFO ("we are at " << beginOfCurrentPacket <<
+                   " searching for " << seq <<
+                   " and now we split because packet ends at "
+                                << beginOfCurrentPacket + outItem->m_packet->GetSize ());
+      TcpTxItem *firstPart = m_itemPool.Allocate ();
+      if (sent)
         {
-          // seq is inside the current packet
-          if (seq == beginOfCurrentPacket)
-            {
-              // seq is the beginning of the current packet. Hurray!
-              outItem = currentItem;
-              NS_LOG_INFO ("Current packet starts at seq " << seq <<
-                           " ends at " << seq + currentPacket->GetSize ());
-            }
-          else if (seq > beginOfCurrentPacket)
-            {
-              // seq is inside the current packet but seq is not the beginning,
-              // it's somewhere in the middle. Just fragment the beginning and
-              // start again.
-              NS_LOG_INFO ("we are at " << beginOfCurrentPacket <<
-                           " searching for " << seq <<
-                           " and now we recurse because packet ends at "
-                                        << beginOfCurrentPacket + currentPacket->GetSize ());
-              TcpTxItem *firstPart = new TcpTxItem ();
-              SplitItems (*firstPart, *currentItem, seq - beginOfCurrentPacket);
-
-              // insert firstPart before currentItem
-              list.insert (it, firstPart);
-              *listEdited = true;
- 
-              return GetPacketFromList (list, listStartFrom, numBytes, seq, listEdited);
-            }
-          else
-            {
-              NS_FATAL_ERROR ("seq < beginOfCurrentPacket: our data is before");
-            }
+          RemoveRetransmit (outItem);
         }
-      else
+      SplitItems (*firstPart, *outItem, seq - beginOfCurrentPacket);
+      if (sent)
         {
-          // Walk the list, the current packet does not contain seq
-          beginOfCurrentPacket += currentPacket->GetSize ();
-          it++;
-          continue;
+          AddRetransmit (firstPart);
+          AddRetransmit (outItem);
         }
 
-      NS_ASSERT (outItem != 0);
-
-      // The objective of this snippet is to find (or to create) the packet
-      // that ends after numBytes bytes. We are sure that outPacket starts
-      // at seq.
+      // insert firstPart before outItem
+      PacketList::iterator firstIt = list.insert (it, firstPart);
+      *listEdited = true;
 
-      if (seq + numBytes <= beginOfCurrentPacket + currentPacket->GetSize ())
+      if (index != 0)
         {
-          // the end boundary is inside the current packet
-          if (numBytes == currentPacket->GetSize ())
-            {
-              // the end boundary is exactly the end of the current packet. Hurray!
-              if (currentItem->m_packet == outItem->m_packet)
-                {
-                  // A perfect match!
-                  return outItem;
-                }
-              else
-                {
-                  // the end is exactly the end of current packet, but
-                  // current > outPacket in the list. Merge current with the
-                  // previous, and recurse.
-                  NS_ASSERT (it != list.begin ());
-                  TcpTxItem *previous = *(--it);
+          (*index)[beginOfCurrentPacket] = firstIt;
+          (*index)[seq] = it;
+        }
+      beginOfCurrentPacket = seq;
+    }
+  else if (seq < beginOfCurrentPacket)
+    {
+      NS_FATAL_ERROR ("seq < beginOfCurrentPacket: our data is before");
+    }
 
-                  list.erase (it);
+  NS_LOG_INFO ("Current packet starts at seq " << seq <<
+               " ends at " << seq + outItem->m_packet->GetSize ());
 
-                  MergeItems (*previous, *currentItem);
-                  delete currentItem;
-                  *listEdited = true;
- 
-                  return GetPacketFromList (list, listStartFrom, numBytes, seq, listEdited);
-                }
-            }
-          else if (numBytes < currentPacket->GetSize ())
-            {
-              // the end is inside the current packet, but it isn't exactly
-              // the packet end. Just fragment, fix the list, and return.
-              TcpTxItem *firstPart = new TcpTxItem ();
-              SplitItems (*firstPart, *currentItem, numBytes);
+  // outItem starts at seq. Merge the packets that follow into it, until it
+  // reaches the requested end.
+  PacketList::iterator next = it;
+  while (outItem->m_packet->GetSize () < numBytes)
+    {
+      if (++next == list.end ())
+        {
+          // outItem is the last packet we sent. We have not more data;
+          // Go for this one.
+          NS_LOG_WARN ("Cannot reach the end, but this case is covered "
+                       "with conditional statements inside CopyFromSequence."
+                       "Something has gone wrong, report a bug");
+          return it;
+        }
 
-              // insert firstPart before currentItem
-              list.insert (it, firstPart);
-              *listEdited = true;
+      TcpTxItem *nextItem = *next;
 
-              return firstPart;
-            }
+      if (index != 0)
+        {
+          index->erase (seq + outItem->m_packet->GetSize ());
         }
-      else
+
+      if (sent)
         {
-          // The end isn't inside current packet, but there is an exception for
-          // the merge and recurse strategy...
-          if (++it == list.end ())
-            {
-              // ...current is the last packet we sent. We have not more data;
-              // Go for this one.
-              NS_LOG_WARN ("Cannot reach the end, but this case is covered "
-                           "with conditional statements inside CopyFromSequence."
-                           "Something has gone wrong, report a bug");
-              return outItem;
-            }
+          RemoveRetransmit (outItem);
+          RemoveRetransmit (nextItem);
+        }
+      MergeItems (*outItem, *nextItem);
+      if (sent)
+        {
+          AddRetransmit (outItem);
+        }
+      next = list.erase (next);
+      --next;
 
-          // The current packet does not contain the requested end. Merge current
-          // with the packet that follows, and recurse
-          TcpTxItem *next = (*it); // Please remember we have incremented it
-                                   // in the previous if
+      m_itemPool.Release (nextItem);
 
-          MergeItems (*currentItem, *next);
-          list.erase (it);
+      *listEdited = true;
+    }
 
-          delete next;
+  if (numBytes < outItem->m_packet->GetSize ())
+    {
+      // the end is inside the current packet, but it isn't exactly
+      // the packet end. Just fragment, fix the list, and return.
+      TcpTxItem *firstPart = m_itemPool.Allocate ();
+      if (sent)
+        {
+          RemoveRetransmit (outItem);
+        }
+      SplitItems (*firstPart, *outItem, numBytes);
+      if (sent)
+        {
+          AddRetransmit (firstPart);
+          AddRetransmit (outItem);
+        }
 
-          *listEdited = true;
+      // insert firstPart before outItem
+      PacketList::iterator firstIt = list.insert (it, firstPart);
+      *listEdited = true;
 
-          return GetPacketFromList (list, listStartFrom, numBytes, seq, listEdited);
+      if (index != 0)
+        {
+          (*index)[seq] = firstIt;
+          (*index)[seq + numBytes] = it;
         }
+
+      return firstIt;
     }
 
-  NS_FATAL_ERROR ("This point is not reachable");
+  return it;
 }
 
 void
 TcpTxBuffer::MergeItems (TcpTxItem &t1, TcpTxItem &t2) const
 {
   NS_LOG_FUNCTION (this);
+  NS_ASSERT (t1.m_framed && t2.m_framed);
   if (t1.m_sacked == true && t2.m_sacked == true)
     {
       t1.m_sacked = true;
@@ -936,6 +1573,11 @@ TcpTxBuffer::MergeItems (TcpTxItem &t1, TcpTxItem &t2) const
     {
       t1.m_lastSent = t2.m_lastSent;
     }
+  if (t1.m_expiry < t2.m_expiry)
+    {
+      t1.m_expiry = t2.m_expiry;
+    }
+  t1.m_pairs += t2.m_pairs;
 
   if (t2.m_lost)
     {
@@ -978,13 +1620,23 @@ Ptr<Packet> p = CopyFromSequence (offset, m_firstByteSeq);
 
       if (offset >= pktSize)
         { 
+          if (item->m_sacked)
+            {
+              --m_sackedOut;
+            }
+          m_pipe -= PipeContribution (item, m_firstByteSeq, m_lostBoundary);
+          RemoveRetransmit (item);
  
 // This packet is behind the seqnum. Remove this packet from the buffer
-         // m_qednum++; 
  m_sentSize -= pktSize;
 if(item->m_qided)
 {
-         m_qednum++;
+         // Pairs the pool has no room for are not ahead of any SEND, and
+         // are regenerated like decohered ones
+         uint32_t dropped = item->m_pairs - GetEntanglementPool ()->Deposit (item->m_pairs, item->m_expiry,
+                                                                             GetDepositor ());
+         ReleaseQedAhead (dropped);
+         m_expiredPending += dropped;
          m_stageSize -= pktSize;
         
  m_stagesentSize -= pktSize;
@@ -1001,16 +1653,19 @@ else
         
           offset -= pktSize;
           m_firstByteSeq += pktSize;
+          m_sentIndex.erase (m_sentIndex.begin ());
           i = m_sentList.erase (i);
-          delete item;
+          m_itemPool.Release (item);
           NS_LOG_INFO ("While removing up to " << seq <<
                        ".Removed one packet of size " << pktSize <<
                        " starting from " << m_firstByteSeq - pktSize <<
                        " remaining " << m_sentSize <<
-                       ". size " << m_size << ". qidsize "<< m_stageSize<<"qidnum: "<<m_qednum);
+                       ". size " << m_size << ". qidsize "<< m_stageSize<<"qidnum: "<<qidnum ());
         }
       else if (offset > 0)
         { // Part of the packet is behind the seqnum. Fragment
+          m_pipe -= PipeContribution (item, m_firstByteSeq, m_lostBoundary);
+          RemoveRetransmit (item);
           pktSize -= offset;
           // PacketTags are preserved when fragmenting
           item->m_packet = item->m_packet->CreateFragment (offset, pktSize);
@@ -1019,7 +1674,7 @@ else
  
   if(item->m_qided)
 {
-          m_qednum+=1; 
+          // The pair is stored once the whole QED is acknowledged
           m_stageSize -= offset;
         //  m_sentSize -= offset;
 m_stagesentSize -= offset;
@@ -1034,6 +1689,10 @@ else
   
 
           m_firstByteSeq += offset;
+          m_sentIndex.erase (m_sentIndex.begin ());
+          m_sentIndex[m_firstByteSeq] = i;
+          m_pipe += PipeContribution (item, m_firstByteSeq, m_lostBoundary);
+          AddRetransmit (item);
           NS_LOG_INFO ("Fragmented one packet by size " << offset <<
                        ", new size=" << pktSize);
           break;
@@ -1055,6 +1714,8 @@ else
           // when crafting the SACK option for a non-SACK receiver.
 
           head->m_sacked = false;
+          --m_sackedOut;
+          m_pipe += PipeContribution (head, m_firstByteSeq, m_lostBoundary);
         }
     }
 
@@ -1063,6 +1724,10 @@ else
       m_highestSack = std::make_pair (m_sentList.end (), SequenceNumber32 (0));
     }
 
+  // Discarding SACKed items lowers the count of SACKs above the others
+  MoveLostBoundary (LostBoundary (m_dupThresh, m_segmentSize));
+  UpdateEligibility ();
+
   NS_LOG_DEBUG ("Discarded up to " << seq);
  NS_LOG_DEBUG ("Discarded up to appsent " << m_appsentSize);
 NS_LOG_DEBUG ("Discarded up to qidsent " << m_stagesentSize);
@@ -1072,25 +1737,62 @@ NS_LOG_DEBUG ("Discarded up to qidsize " << m_stageSize);
   NS_ASSERT (m_firstByteSeq >= seq);
 }
 
+/// Maximum number of blocks in a SACK option (RFC 2018: 40 bytes of options)
+static const uint32_t MAX_SACK_BLOCKS = 4;
+
+/**
+ * \brief Order SACK blocks by their left edge
+ * \param a first block
+ * \param b second block
+ * \return true if a starts before b
+ */
+static bool
+SackBlockBefore (const TcpOptionSack::SackBlock &a, const TcpOptionSack::SackBlock &b)
+{
+  return a.first < b.first;
+}
+
 bool
 TcpTxBuffer::Update (const TcpOptionSack::SackList &list)
 {
   NS_LOG_FUNCTION (this);
 
   bool modified = false;
-  TcpOptionSack::SackList::const_iterator option_it;
   NS_LOG_INFO ("Updating scoreboard, got " << list.size () << " blocks to analyze");
-  for (option_it = list.begin (); option_it != list.end (); ++option_it)
+
+  // Apply the blocks in sequence order, in a single forward sweep over the
+  // SentList: the items passed by a block are all SACKed, so the next block
+  // can resume from where the previous one stopped. The blocks are sorted
+  // on the stack: an option holds a handful of them
+  NS_ASSERT_MSG (list.size () <= MAX_SACK_BLOCKS, "More blocks than a SACK option holds");
+  TcpOptionSack::SackBlock blocks[MAX_SACK_BLOCKS];
+  uint32_t nBlocks = 0;
+  TcpOptionSack::SackList::const_iterator list_it;
+  for (list_it = list.begin (); list_it != list.end () && nBlocks < MAX_SACK_BLOCKS; ++list_it)
+    {
+      blocks[nBlocks++] = *list_it;
+    }
+  std::sort (blocks, blocks + nBlocks, SackBlockBefore);
+
+  SentIndex::const_iterator idx = m_sentIndex.end ();
+  for (uint32_t i = 0; i < nBlocks; ++i)
     {
       Ptr<Packet> current;
       TcpTxItem *item;
-      const TcpOptionSack::SackBlock b = (*option_it);
+      const TcpOptionSack::SackBlock b = blocks[i];
 
-      PacketList::iterator item_it = m_sentList.begin ();
-      SequenceNumber32 beginOfCurrentPacket = m_firstByteSeq;
+      // Items starting before the block cannot be covered by it: begin the
+      // walk from the first item starting inside the block, unless the sweep
+      // is already past it
+      if (idx == m_sentIndex.end () || idx->first < b.first)
+        {
+          idx = m_sentIndex.lower_bound (b.first);
+        }
 
-      while (item_it != m_sentList.end ())
+      while (idx != m_sentIndex.end ())
         {
+          PacketList::iterator item_it = idx->second;
+          SequenceNumber32 beginOfCurrentPacket = idx->first;
           item = *item_it;
           current = item->m_packet;
 
@@ -1108,7 +1810,9 @@ TcpTxBuffer::Update (const TcpOptionSack::SackList &list)
                 }
               else
                 {
+                  m_pipe -= PipeContribution (item, beginOfCurrentPacket, m_lostBoundary);
                   item->m_sacked = true;
+                  ++m_sackedOut;
                   NS_LOG_INFO ("Received block [" << b.first << ";" << b.second <<
                                ", checking sentList for block " << beginOfCurrentPacket <<
                                ";" << beginOfCurrentPacket + current->GetSize () <<
@@ -1132,13 +1836,18 @@ TcpTxBuffer::Update (const TcpOptionSack::SackList &list)
               break;
             }
 
-          beginOfCurrentPacket += current->GetSize ();
-          ++item_it;
+          ++idx;
         }
     }
 
   NS_ASSERT ((*(m_sentList.begin ()))->m_sacked == false);
 
+  if (modified)
+    {
+      // New SACKs can only move the lost boundary toward the tail
+      MoveLostBoundary (LostBoundary (m_dupThresh, m_segmentSize));
+    }
+
   return modified;
 }
 
@@ -1147,14 +1856,6 @@ TcpTxBuffer::IsLost (const SequenceNumber32 &seq, const PacketList::const_iterat
                      uint32_t dupThresh, uint32_t segmentSize) const
 {
   NS_LOG_FUNCTION (this << seq << dupThresh << segmentSize);
-  uint32_t count = 0;
-  uint32_t bytes = 0;
-  PacketList::const_iterator it;
-  TcpTxItem *item;
-  Ptr<const Packet> current;
-  SequenceNumber32 beginOfCurrentPacket = seq;
-
-  //NS_LOG_INFO ("Checking if seq=" << seq << " is lost from the buffer ");
 
   if ((*segment)->m_lost == true)
     {
@@ -1164,7 +1865,6 @@ TcpTxBuffer::IsLost (const SequenceNumber32 &seq, const PacketList::const_iterat
  
   if ((*segment)->m_sacked == true)
     {
-     // NS_LOG_INFO ("qid1="<<(*segment)->m_qided);
 NS_LOG_INFO ("seq2=" << seq << " is not lost because of sacked flag");
       return false;
     }
@@ -1174,36 +1874,22 @@ NS_LOG_INFO ("seq2=" << seq << " is not lost because of sacked flag");
   // > sequences have arrived above 'seq' or more than (dupThresh - 1) * SMSS bytes
   // > with sequence numbers greater than 'SeqNum' have been SACKed.  Otherwise, the
   // > routine returns false.
-  for (it = segment; it != m_highestSack.first; ++it)
-    {
-      if (beginOfCurrentPacket >= m_highestSack.second)
-        {
-         //NS_LOG_INFO ("qid2="<<(*it)->m_qided);
-
-         NS_LOG_INFO ("seq3=" << seq << " is not lost because there are no sacked segment ahead");
-          return false;
-        }
-
-      item = *it;
-      current = item->m_packet;
+  // The segments for which the condition holds are the ones starting before
+  // the lost boundary, which the scoreboard keeps up to date.
+  SequenceNumber32 lostBoundary = m_lostBoundary;
 
-      if (item->m_sacked)
-        {
-          NS_LOG_INFO ("Segment [" << beginOfCurrentPacket << ", " <<
-                       beginOfCurrentPacket+item->m_packet->GetSize () <<
-                       "] found to be SACKed");
-          ++count;
-          bytes += current->GetSize ();
-          if ((count >= dupThresh) || (bytes > (dupThresh-1) * segmentSize))
-            {
-              NS_LOG_INFO ("seq4=" << seq << " is lost because of 3 sacked blocks ahead");
-              return true;
-            }
-        }
+  if (dupThresh != m_dupThresh || segmentSize != m_segmentSize)
+    {
+      lostBoundary = LostBoundary (dupThresh, segmentSize);
+    }
 
-      beginOfCurrentPacket += current->GetSize ();
+  if (seq < lostBoundary)
+    {
+      NS_LOG_INFO ("seq4=" << seq << " is lost because of 3 sacked blocks ahead");
+      return true;
     }
 
+  NS_LOG_INFO ("seq3=" << seq << " is not lost because there are not enough sacked segments ahead");
   return false;
 }
 
@@ -1213,29 +1899,20 @@ TcpTxBuffer::IsLost (const SequenceNumber32 &seq, uint32_t dupThresh,
 {
   NS_LOG_FUNCTION (this << seq << dupThresh);
 
-  SequenceNumber32 beginOfCurrentPacket = m_firstByteSeq;
-  PacketList::const_iterator it;
-
   if (seq >= m_highestSack.second)
     {
       return false;
     }
 
-  // This O(n) method is called only once, and outside this class.
-  // It should not harm the performance
-  for (it = m_sentList.begin (); it != m_sentList.end (); ++it)
-    {
-      // Search for the right iterator before calling IsLost()
-      if (beginOfCurrentPacket >= seq)
-        {
-
-          return IsLost (beginOfCurrentPacket, it, dupThresh, segmentSize);
-        }
+  // Search for the first item starting at or after seq before calling IsLost()
+  SentIndex::const_iterator idx = m_sentIndex.lower_bound (seq);
 
-      beginOfCurrentPacket += (*it)->m_packet->GetSize ();
+  if (idx == m_sentIndex.end ())
+    {
+      return false;
     }
 
-  return false;
+  return IsLost (idx->first, idx->second, dupThresh, segmentSize);
 }
 
 bool
@@ -1262,6 +1939,8 @@ TcpTxBuffer::NextSeg (SequenceNumber32 *seq, uint32_t dupThresh,
   TcpTxItem *item;
   SequenceNumber32 seqPerRule3;
   bool isSeqPerRule3Valid = false;
+  SequenceNumber32 lostQed;
+  bool isLostQedValid = false;
   SequenceNumber32 beginOfCurrentPkt = m_firstByteSeq;
 
   for (it = m_sentList.begin (); it != m_sentList.end (); ++it)
@@ -1273,8 +1952,17 @@ TcpTxBuffer::NextSeg (SequenceNumber32 *seq, uint32_t dupThresh,
         {
           if (IsLost (beginOfCurrentPkt, it, dupThresh, segmentSize))
             {
-              *seq = beginOfCurrentPkt;
-              return true;
+              if (!item->m_qided || m_qedLossPolicy != QED_SEND_FIRST)
+                {
+                  *seq = beginOfCurrentPkt;
+                  return true;
+                }
+              // A lost SEND further on goes first
+              if (!isLostQedValid)
+                {
+                  isLostQedValid = true;
+                  lostQed = beginOfCurrentPkt;
+                }
             }
           else if (seqPerRule3.GetValue () == 0 && isRecovery)
             {
@@ -1287,6 +1975,12 @@ TcpTxBuffer::NextSeg (SequenceNumber32 *seq, uint32_t dupThresh,
       beginOfCurrentPkt += item->m_packet->GetSize ();
     }
 
+  if (isLostQedValid)
+    {
+      *seq = lostQed;
+      return true;
+    }
+
   /* (2) If no sequence number 'S2' per rule (1) exists but there
    *     exists available unsent data and the receiver's advertised
    *     window allows, the sequence range of one segment of up to SMSS
@@ -1330,53 +2024,174 @@ uint32_t
 TcpTxBuffer::GetRetransmitsCount (void) const
 {
   NS_LOG_FUNCTION (this);
-  PacketList::const_iterator it;
-  TcpTxItem *item;
-  uint32_t count = 0;
-  for (it = m_sentList.begin (); it != m_sentList.end (); ++it)
-    {
-      item = *it;
-      if (item->m_retrans)
-        {
-          count++;
-        }
-    }
-  return count;
+  return m_retransOut;
+}
+
+uint32_t
+TcpTxBuffer::GetRetransmitsBytes (void) const
+{
+  NS_LOG_FUNCTION (this);
+  return m_retransBytes;
 }
 
 uint32_t
 TcpTxBuffer::BytesInFlight (uint32_t dupThresh, uint32_t segmentSize) const
 {
+  if (dupThresh == m_dupThresh && segmentSize == m_segmentSize)
+    {
+      NS_LOG_INFO ("BytesInFlight size=="<<m_pipe);
+      return m_pipe;
+    }
+
+  // The scoreboard is kept for other values: compute the pipe from scratch
   PacketList::const_iterator it;
-  TcpTxItem *item;
   uint32_t size =0; // "pipe" in RFC
   SequenceNumber32 beginOfCurrentPkt = m_firstByteSeq;
+  SequenceNumber32 lostBoundary = LostBoundary (dupThresh, segmentSize);
+
+  for (it = m_sentList.begin (); it != m_sentList.end (); ++it)
+    {
+      size += PipeContribution (*it, beginOfCurrentPkt, lostBoundary);
+      beginOfCurrentPkt += (*it)->m_packet->GetSize ();
+    }
+NS_LOG_INFO ("BytesInFlight size=="<<size);
+  return size;
+}
 
+uint32_t
+TcpTxBuffer::PipeContribution (const TcpTxItem *item, const SequenceNumber32 &begin,
+                               const SequenceNumber32 &lostBoundary) const
+{
   // After initializing pipe to zero, the following steps are taken for each
   // octet 'S1' in the sequence space between HighACK and HighData that has not
   // been SACKed:
-  for (it = m_sentList.begin (); it != m_sentList.end (); ++it)
+  if (item->m_sacked)
     {
-      item = *it;
-      if (!item->m_sacked)
+      return 0;
+    }
+
+  // (a) If IsLost (S1) returns false: Pipe is incremented by 1 octet.
+  if (!item->m_lost && begin >= lostBoundary)
+    {
+      return item->m_packet->GetSize ();
+    }
+  // (b) If S1 <= HighRxt: Pipe is incremented by 1 octet.
+  // (NOTE: we use the m_retrans flag instead of keeping and updating
+  // another variable). Only if the item is not marked as lost
+  else if (item->m_retrans && !item->m_lost)
+    {
+      return item->m_packet->GetSize ();
+    }
+
+  return 0;
+}
+
+SequenceNumber32
+TcpTxBuffer::LostBoundary (uint32_t dupThresh, uint32_t segmentSize) const
+{
+  NS_LOG_FUNCTION (this << dupThresh << segmentSize);
+
+  if (m_sackedOut == 0)
+    {
+      return m_firstByteSeq;
+    }
+
+  // Only the SACKs up to the highest SACK are counted, as in RFC 6675
+  SentIndex::const_iterator idx = m_sentIndex.lower_bound (m_highestSack.second);
+  uint32_t count = 0;
+  uint32_t bytes = 0;
+
+  while (idx != m_sentIndex.begin ())
+    {
+      --idx;
+      const TcpTxItem *item = *(idx->second);
+
+      if (item->m_sacked)
         {
-          // (a) If IsLost (S1) returns false: Pipe is incremented by 1 octet.
-          if (!IsLost (beginOfCurrentPkt, it, dupThresh, segmentSize))
-            {
-              size += item->m_packet->GetSize ();
-            }
-          // (b) If S1 <= HighRxt: Pipe is incremented by 1 octet.
-          // (NOTE: we use the m_retrans flag instead of keeping and updating
-          // another variable). Only if the item is not marked as lost
-          else if (item->m_retrans && !item->m_lost)
+          ++count;
+          bytes += item->m_packet->GetSize ();
+          if ((count >= dupThresh) || (bytes > (dupThresh-1) * segmentSize))
             {
-              size += item->m_packet->GetSize ();
+              return idx->first;
             }
         }
-      beginOfCurrentPkt += item->m_packet->GetSize ();
     }
-NS_LOG_INFO ("BytesInFlight size=="<<size);
-  return size;
+
+  return m_firstByteSeq;
+}
+
+void
+TcpTxBuffer::MoveLostBoundary (const SequenceNumber32 &boundary)
+{
+  NS_LOG_FUNCTION (this << boundary);
+
+  if (boundary == m_lostBoundary)
+    {
+      return;
+    }
+
+  // Only the items between the old and the new boundary change state
+  SequenceNumber32 low = std::min (boundary, m_lostBoundary);
+  SequenceNumber32 high = std::max (boundary, m_lostBoundary);
+  SentIndex::const_iterator idx = m_sentIndex.lower_bound (low);
+
+  while (idx != m_sentIndex.end () && idx->first < high)
+    {
+      const TcpTxItem *item = *(idx->second);
+      m_pipe -= PipeContribution (item, idx->first, m_lostBoundary);
+      m_pipe += PipeContribution (item, idx->first, boundary);
+      ++idx;
+    }
+
+  m_lostBoundary = boundary;
+}
+
+void
+TcpTxBuffer::RecomputeScoreboard (void)
+{
+  NS_LOG_FUNCTION (this);
+
+  PacketList::const_iterator it;
+  SequenceNumber32 beginOfCurrentPkt = m_firstByteSeq;
+
+  m_sackedOut = 0;
+  for (it = m_sentList.begin (); it != m_sentList.end (); ++it)
+    {
+      if ((*it)->m_sacked)
+        {
+          ++m_sackedOut;
+        }
+    }
+
+  m_lostBoundary = LostBoundary (m_dupThresh, m_segmentSize);
+  m_pipe = 0;
+
+  for (it = m_sentList.begin (); it != m_sentList.end (); ++it)
+    {
+      m_pipe += PipeContribution (*it, beginOfCurrentPkt, m_lostBoundary);
+      beginOfCurrentPkt += (*it)->m_packet->GetSize ();
+    }
+}
+
+void
+TcpTxBuffer::AddRetransmit (const TcpTxItem *item)
+{
+  if (item->m_retrans)
+    {
+      m_retransOut = m_retransOut + 1;
+      m_retransBytes += item->m_packet->GetSize ();
+    }
+}
+
+void
+TcpTxBuffer::RemoveRetransmit (const TcpTxItem *item)
+{
+  if (item->m_retrans)
+    {
+      NS_ASSERT (m_retransOut > 0 && m_retransBytes >= item->m_packet->GetSize ());
+      m_retransOut = m_retransOut - 1;
+      m_retransBytes -= item->m_packet->GetSize ();
+    }
 }
 
 void
@@ -1394,6 +2209,7 @@ TcpTxBuffer::ResetScoreboard ()
     }
 
   m_highestSack = std::make_pair (m_sentList.end (), SequenceNumber32 (0));
+  RecomputeScoreboard ();
 }
 
 void
@@ -1410,12 +2226,16 @@ TcpTxBuffer::ResetSentList (uint32_t keepItems)
   NS_LOG_INFO ("222m_sentList.size ()=" << m_sentList.size () << " keepItems =="<<keepItems);
  NS_LOG_INFO ("222m_appsentsize =="<<m_appsentSize <<"  qidsentsize== "<<m_stagesentSize<<" m_sentSize="<<m_sentSize);
       item = m_sentList.back ();
+      RemoveRetransmit (item);
       item->m_retrans = item->m_sacked = false;
 if(item->m_qided)
 {
 
         m_qidList.push_front (item); 
         m_sentList.pop_back ();
+        ReleaseQedAhead (item->m_pairs);
+        item->m_pairs = 0;
+        m_sentIndex.erase (--m_sentIndex.end ());
 NS_LOG_INFO ("333m_sentList.size ()=" << m_sentList.size () << " keepItems =="<<keepItems);
  NS_LOG_INFO ("333m_appsentsize =="<<m_appsentSize <<"  qidsentsize== "<<m_stagesentSize<<" m_sentSize="<<m_sentSize);
   if (m_sentList.size () > 0)
@@ -1423,6 +2243,7 @@ NS_LOG_INFO ("333m_sentList.size ()=" << m_sentList.size () << " keepItems =="<<
       item = m_sentList.back ();
       item->m_lost = true;
       item->m_sacked = false;
+      RemoveRetransmit (item);
       item->m_retrans = false;
 
 
@@ -1440,9 +2261,10 @@ NS_LOG_INFO ("333m_sentList.size ()=" << m_sentList.size () << " keepItems =="<<
 else
 {
    m_appnum++;
-m_qednum++;  //Transmitted data will consume one more entanglement.
+        RefundPair (item);  //Transmitted data will consume one more entanglement.
         m_appList.push_front (item); 
         m_sentList.pop_back ();
+        m_sentIndex.erase (--m_sentIndex.end ());
 NS_LOG_INFO ("444m_sentList.size ()=" << m_sentList.size () << " keepItems =="<<keepItems);
  NS_LOG_INFO ("444m_appsentsize =="<<m_appsentSize <<"  qidsentsize== "<<m_stagesentSize<<" m_sentSize="<<m_sentSize);
   if (m_sentList.size () > 0)
@@ -1450,6 +2272,7 @@ NS_LOG_INFO ("444m_sentList.size ()=" << m_sentList.size () << " keepItems =="<<
       item = m_sentList.back ();
       item->m_lost = true;
       item->m_sacked = false;
+      RemoveRetransmit (item);
       item->m_retrans = false;
 
 m_appsentSize-= item->m_packet->GetSize ();
@@ -1469,6 +2292,8 @@ NS_LOG_INFO ("555m_sentList.size ()=" << m_sentList.size () << " keepItems =="<<
  NS_LOG_INFO ("555m_appsentsize =="<<m_appsentSize <<"  qidsentsize== "<<m_stagesentSize<<" m_sentSize="<<m_sentSize); 
 
   m_highestSack = std::make_pair (m_sentList.end (), SequenceNumber32 (0));
+  RecomputeScoreboard ();
+  UpdateEligibility ();
 }
 
 void
@@ -1480,19 +2305,27 @@ TcpTxBuffer::ResetLastSegmentSent ()
       TcpTxItem *item = m_sentList.back ();
 
       m_sentList.pop_back ();
+      m_sentIndex.erase (--m_sentIndex.end ());
+      RemoveRetransmit (item);
   m_sentSize -= item->m_packet->GetSize ();
 if(!item->m_qided)
 {
     
  m_appsentSize -= item->m_packet->GetSize ();
       m_appList.insert (m_appList.begin (), item);
+      // The SEND will take a pair again when it is transmitted
+      RefundPair (item);
 }
 else
 { 
    
  m_stagesentSize -= item->m_packet->GetSize ();
      m_qidList.insert (m_qidList.begin (), item);
+     ReleaseQedAhead (item->m_pairs);
+     item->m_pairs = 0;
 }
+      RecomputeScoreboard ();
+      UpdateEligibility ();
     }
 }
 
@@ -1507,6 +2340,9 @@ TcpTxBuffer::SetSentListLost ()
     {
       (*it)->m_lost = true;
     }
+
+  // Nothing marked as lost counts in the pipe
+  m_pipe = 0;
 }
 
 bool
@@ -1546,6 +2382,18 @@ TcpTxBuffer::CraftSackOption (const SequenceNumber32 &seq, uint8_t available) co
       beginOfCurrentPacket = m_highestSack.second;
     }
 
+  if (seq > beginOfCurrentPacket)
+    {
+      // Items starting before seq are not usable: skip them with the index
+      SentIndex::const_iterator idx = m_sentIndex.lower_bound (seq);
+      if (idx == m_sentIndex.end ())
+        {
+          return sackBlock;
+        }
+      it = idx->second;
+      beginOfCurrentPacket = idx->first;
+    }
+
   while (it != m_sentList.end ())
     {
       item = *it;
@@ -1648,11 +2496,11 @@ appsentSize += p->GetSize ();
 
   for (it = tcpTxBuf.m_appList.begin (); it != tcpTxBuf.m_appList.end (); ++it)
     {
-      appSize += (*it)->m_packet->GetSize ();
+      appSize += (*it)->GetSeqSize ();
     }
   for (it = tcpTxBuf.m_qidList.begin (); it != tcpTxBuf.m_qidList.end (); ++it)
     {
-      qidSize += (*it)->m_packet->GetSize ();
+      qidSize += (*it)->GetSeqSize ();
     }
 
   os << "Sent list: " << ss.str () << ", size = " << tcpTxBuf.m_sentList.size () <<
@@ -22,11 +22,17 @@
 #ifndef TCP_TX_BUFFER_H
 #define TCP_TX_BUFFER_H
 
+#include <map>
+#include <vector>
+
 #include "ns3/object.h"
 #include "ns3/traced-value.h"
 #include "ns3/sequence-number.h"
 #include "ns3/nstime.h"
 #include "ns3/tcp-option-sack.h"
+#include "qtcp-header.h"
+#include "qtcp-encoder.h"
+#include "entanglement-pool.h"
 
 namespace ns3 {
 class Packet;
@@ -56,6 +62,12 @@ public:
    */
   void Print (std::ostream &os) const;
 
+  /**
+   * \brief Get the sequence space taken by the item
+   * \return the size of the framed record, even if it is not framed yet
+   */
+  uint32_t GetSeqSize (void) const;
+
   Ptr<Packet> m_packet; //!< Application packet
   bool m_lost;          //!< Indicates if the segment has been lost (RTO)
   bool m_retrans;       //!< Indicates if the segment is retransmitted
@@ -63,6 +75,76 @@ public:
                         //   been sent last time
   bool m_sacked;        //!< Indicates if the segment has been SACKed
   bool m_qided;        //!< Indicates if the segment has been qided
+  bool m_framed;       //!< m_packet holds the whole record, not only the payload
+  Time m_expiry;       //!< Time at which the entanglement of a QED decoheres, or
+                       //   the pair taken by a SEND (Time::Min (): no pair)
+  uint32_t m_pairs;    //!< Pairs counted in QedAhead for the item: established
+                       //   by the QED, or taken by the SEND from this buffer
+  QtcpHeader m_header; //!< Header of the record, used to frame it (LazyFraming)
+};
+
+/**
+ * \ingroup tcp
+ *
+ * \brief Slab allocator for TcpTxItem
+ *
+ * Items are carved out of blocks of TcpTxItem allocated in one shot, and
+ * released items are kept in a free list and handed out again by the next
+ * Allocate(). In steady state (items discarded as fast as the application
+ * adds them) the buffer does not touch the heap for its items at all.
+ *
+ * All the items returned by Allocate() are owned by the pool: they must be
+ * given back with Release(), never deleted. The blocks are freed when the
+ * pool is destroyed.
+ */
+class TcpTxItemPool
+{
+public:
+  /**
+   * \brief Constructor
+   */
+  TcpTxItemPool ();
+
+  /**
+   * \brief Copy-constructor
+   *
+   * Items are never shared between pools, so the copy starts empty.
+   *
+   * \param other pool to copy (ignored)
+   */
+  TcpTxItemPool (const TcpTxItemPool &other);
+
+  /**
+   * \brief Destructor: frees all the blocks
+   */
+  ~TcpTxItemPool ();
+
+  /**
+   * \brief Get an item with all the fields at their default value
+   * \return a new item, owned by the pool
+   */
+  TcpTxItem* Allocate (void);
+
+  /**
+   * \brief Give back an item obtained with Allocate()
+   * \param item the item to recycle
+   */
+  void Release (TcpTxItem *item);
+
+  /**
+   * \brief Get the number of items handed out without a heap allocation
+   * \return the number of allocations avoided
+   */
+  uint64_t GetAllocationsAvoided (void) const;
+
+private:
+  TcpTxItemPool &operator= (const TcpTxItemPool &);
+
+  static const uint32_t BLOCK_ITEMS = 64; //!< Items allocated with each block
+
+  std::vector<TcpTxItem*> m_blocks;   //!< Blocks of BLOCK_ITEMS items
+  std::vector<TcpTxItem*> m_free;     //!< Items ready to be handed out
+  uint64_t m_allocated;               //!< Items handed out
 };
 
 /**
@@ -120,6 +202,26 @@ public:
  * other possible improvements; if you wish, take a look and try  to add some
  * earlier exit conditions in the loops.
  *
+ * To avoid walking the SentList only to find the item that holds a given
+ * sequence number, the buffer keeps an index (m_sentIndex) which maps the
+ * starting sequence of every item in the SentList to its position in the list.
+ * Retransmissions, SACK processing and SACK crafting locate their starting
+ * item with a lookup in the index (O(log n)) instead of a scan from
+ * m_firstByteSeq. The index is updated every time an item enters or leaves the
+ * SentList, or is split or merged.
+ *
+ * On top of the flags, the buffer keeps a small scoreboard which is updated
+ * every time an item changes state (it is sent, retransmitted, SACKed, marked
+ * as lost or discarded): the number of SACKed items, the bytes in flight
+ * ("pipe" in RFC 6675) and the lost boundary. Since the number of SACKed
+ * items above a sequence can only decrease while moving toward the tail, all
+ * the un-SACKed items which IsLost() would find lost because of the SACKs
+ * received are the ones starting before a single sequence, the lost boundary.
+ * With the boundary, IsLost() and BytesInFlight() are O(1) reads. The
+ * scoreboard is computed for the DupAck threshold and segment size configured
+ * through SetDupAckThresh and SetSegmentSize; queries made with different
+ * values fall back to a linear computation.
+ *
  * \see Size
  * \see SizeFromSequence
  * \see CopyFromSequence
@@ -127,6 +229,16 @@ public:
 class TcpTxBuffer : public Object
 {
 public:
+  /**
+   * \brief Recovery of the lost QED records
+   */
+  enum QedLossPolicy
+  {
+    QED_REGENERATE, //!< Retransmit a lost QED regenerated in place, with new QTCP sequence numbers
+    QED_RESEND,     //!< Retransmit a lost QED unchanged
+    QED_SEND_FIRST  //!< As QED_RESEND, and retransmit the lost SENDs before the lost QEDs
+  };
+
   /**
    * \brief Get the type ID.
    * \return the object TypeId
@@ -164,6 +276,73 @@ public:
   uint32_t AppsentSize (void) const;
   uint32_t qidnum (void) const;
   uint32_t qideable (void) const;
+
+  /**
+   * \brief Get the number of QED records sent ahead of their SEND
+   * \returns the QEDs transmitted whose SEND is not transmitted yet
+   */
+  uint32_t GetQedAhead (void) const;
+
+  /**
+   * \brief Check if new data must wait for an entanglement
+   *
+   * With a QedLookahead depth k > 0, a new QED is transmitted only while
+   * less than k QEDs are ahead of their SEND, and a SEND only when an
+   * entanglement is available. When neither is possible, the next new
+   * segment has to wait for the ACK of a QED.
+   *
+   * \returns true if no new segment can be transmitted now
+   */
+  bool IsQedLookaheadFull (void) const;
+
+  /**
+   * \brief Check if new data is stalled for lack of entanglement
+   *
+   * True when no entanglement is available, and the QED or the SEND records
+   * in the buffer have all been transmitted. The EntanglementBlocked trace
+   * source samples it when the lists change and when the buffer stores or
+   * takes pairs; pairs the pool generates, or another buffer deposits, are
+   * seen at the next such event.
+   *
+   * \returns true if SendPendingData must wait for an entanglement
+   */
+  bool IsBlockedOnEntanglement (void) const;
+
+  /**
+   * \brief Check if the next new segment is a SEND without a pair
+   *
+   * True when no entanglement is available, SEND records wait, and no QED
+   * record waits to establish a pair. Unlike IsBlockedOnEntanglement, the
+   * retransmissions can still go.
+   *
+   * \returns true if no new segment can be transmitted now
+   */
+  bool IsSendStarved (void) const;
+
+  /**
+   * \brief Check if the buffer holds data and waits for an entanglement
+   *
+   * Wider than IsBlockedOnEntanglement: also true when one of the two lists
+   * is empty.
+   *
+   * \returns true if no entanglement is available, the buffer is not empty,
+   * and the QED or the SEND list has no unsent data
+   */
+  bool IsWaitingForEntanglement (void) const;
+
+  /**
+   * \brief Queue a new QED record for every entanglement that was lost
+   *
+   * A pair established by a QED can leave the pool before a SEND of this
+   * buffer takes it: it decoheres (EntanglementLifetime), the pool has no
+   * room for it (Capacity), or another buffer sharing the pool takes it. A
+   * SEND waiting for it would never get its pair: a regenerated QED, as
+   * large as the last queued SEND, is queued for each of them (while there
+   * is room in the buffer) at the head of the unsent QEDs, before the SEND
+   * asks for it. Only the pairs deposited by this buffer are regenerated
+   * here.
+   */
+  void ReclaimExpired (void);
   /**
    * \brief Get the maximum buffer size
    * \returns the Tx window size (in bytes)
@@ -175,6 +354,84 @@ public:
    * \param n Tx window size (in bytes)
    */
   void SetMaxBufferSize (uint32_t n);
+
+  /**
+   * \brief Set the DupAckThresh used by the scoreboard
+   * \param dupAckThresh the threshold
+   */
+  void SetDupAckThresh (uint32_t dupAckThresh);
+
+  /**
+   * \brief Set the segment size used by the scoreboard
+   * \param segmentSize the segment size
+   */
+  void SetSegmentSize (uint32_t segmentSize);
+
+  /**
+   * \brief Set the recovery of the lost QED records
+   * \param policy the policy
+   */
+  void SetQedLossPolicy (QedLossPolicy policy);
+
+  /**
+   * \brief Get the recovery of the lost QED records
+   * \return the policy
+   */
+  QedLossPolicy GetQedLossPolicy (void) const;
+
+  /**
+   * \brief Set the redundancy length of the messages added from now on
+   *
+   * The messages already in the buffer keep the length they were framed
+   * with; every record carries its own length in its QtcpHeader.
+   *
+   * \param red redundancy length (bytes)
+   */
+  void SetRedundancy (uint8_t red);
+
+  /**
+   * \brief Get the redundancy length of the messages added from now on
+   * \return redundancy length (bytes)
+   */
+  uint8_t GetRedundancy (void) const;
+
+  /**
+   * \brief Check if the head of the SentList is a QED record
+   * \return true if the first unacknowledged segment is a QED
+   */
+  bool IsHeadQed (void) const;
+
+  /**
+   * \brief Get the number of TcpTxItem obtained from the item pool without
+   * a heap allocation
+   * \return the number of allocations avoided
+   */
+  uint64_t GetItemAllocationsAvoided (void) const;
+
+  /**
+   * \brief Set the encoder of the QED redundancy, replacing the one built from
+   * the EncoderType attribute
+   * \param encoder the encoder
+   */
+  void SetEncoder (Ptr<QtcpEncoder> encoder);
+
+  /**
+   * \brief Get the encoder of the QED redundancy
+   * \return the encoder (created from EncoderType on first use)
+   */
+  Ptr<QtcpEncoder> GetEncoder (void);
+
+  /**
+   * \brief Set the pool of the entanglement pairs used by the SEND records
+   * \param pool the pool, possibly shared with other connections
+   */
+  void SetEntanglementPool (Ptr<EntanglementPool> pool);
+
+  /**
+   * \brief Get the pool of the entanglement pairs used by the SEND records
+   * \return the pool (a private one is created on first use)
+   */
+  Ptr<EntanglementPool> GetEntanglementPool (void);
  // void TcpTxBuffer::Setqidnum (void);
   /**
    * \brief Returns the available capacity of this buffer
@@ -182,16 +439,39 @@ public:
    */
   uint32_t Available (void) const;
 
+  /**
+   * \brief Build the body of a QED: the payload followed by REDSIZE bytes of
+   * redundancy, encoded by the encoder of the buffer
+   *
+   * \param p the payload
+   * \return the encoded body
+   */
+  Ptr<Packet> Encode (Ptr<const Packet> p);
+ //bool Decode(Ptr<Packet> p,Ptr<Packet> q,uint32_t m);//
+
   /**
    * \brief Append a data packet to the end of the buffer
    *
+   * The packet is queued as a QED record and a SEND record. With the
+   * LazyFraming attribute, only a reference to the payload is kept, and the
+   * records are built when they are transmitted.
+   *
    * \param p The packet to be appended to the Tx buffer
    * \return Boolean to indicate success
    */
-
-void Encode(Ptr<Packet> p,Ptr<Packet> q);//
- //bool Decode(Ptr<Packet> p,Ptr<Packet> q,uint32_t m);//
  bool Add (Ptr<Packet> p);
+
+  /**
+   * \brief Append a batch of packets to the end of the buffer
+   *
+   * The packets are admitted in order, with a single capacity check, as
+   * long as Add () would take them; their records are queued in one pass,
+   * with contiguous QTCP sequence numbers.
+   *
+   * \param packets the packets to be appended
+   * \return the number of packets admitted (the first ones of the batch)
+   */
+  uint32_t AddBatch (const std::vector<Ptr<Packet> > &packets);
  bool Addqed (Ptr<Packet> p);
  bool Addapp (Ptr<Packet> p);
  bool Addqednew (TcpTxItem *p);
@@ -225,6 +505,36 @@ void Encode(Ptr<Packet> p,Ptr<Packet> q);//
    */
   Ptr<Packet> CopyFromSequence (uint32_t numBytes, const SequenceNumber32& seq);
 
+  /**
+   * \brief Reserve the range [seq, seq+numBytes) for a later transmission
+   *
+   * Same bookkeeping as CopyFromSequence (the block is moved into the
+   * SentList and counted in flight), but no packet is built. The block is
+   * obtained with CopyReserved when it is actually transmitted, e.g. by the
+   * pacer.
+   *
+   * \param numBytes number of bytes to reserve
+   * \param seq start sequence number to reserve
+   * \returns the size of the block reserved, the one CopyFromSequence would
+   * have returned
+   */
+  uint32_t Reserve (uint32_t numBytes, const SequenceNumber32& seq);
+
+  /**
+   * \brief Get the packet of a block reserved with Reserve
+   *
+   * The block is stamped with the transmission time; it is not counted as a
+   * retransmission. If it has been acknowledged meanwhile, an empty packet is
+   * returned; if only its head has, the remainder is returned and seq is
+   * moved to its start.
+   *
+   * \param numBytes size returned by Reserve
+   * \param seq start sequence number given to Reserve, updated to the start
+   * of the returned packet
+   * \returns a packet
+   */
+  Ptr<Packet> CopyReserved (uint32_t numBytes, SequenceNumber32& seq);
+
   /**
    * \brief Set the head sequence of the buffer
    *
@@ -261,6 +571,9 @@ void Encode(Ptr<Packet> p,Ptr<Packet> q);//
   /**
    * \brief Get the next sequence number to transmit, according to RFC 6675
    *
+   * With the QED_SEND_FIRST policy, the lost SEND records are returned by
+   * rule (1) before the lost QED records.
+   *
    * \param seq Next sequence number to transmit, based on the scoreboard information
    * \param dupThresh dupAck threshold
    * \param segmentSize segment size
@@ -275,12 +588,21 @@ void Encode(Ptr<Packet> p,Ptr<Packet> q);//
    * have been transmitted more than once, without acknowledgment.
    *
    * This method is to support the retransmits count for determining PipeSize
-   * in NewReno-style TCP.
+   * in NewReno-style TCP. The count is kept up to date while the SentList
+   * changes, so this call does not walk the list.
    *
    * \returns number of segments that have been transmitted more than once, without acknowledgment
    */
   uint32_t GetRetransmitsCount (void) const;
 
+  /**
+   * \brief Return the bytes of the segments in the sent list that
+   * have been transmitted more than once, without acknowledgment.
+   *
+   * \returns bytes of the segments counted by GetRetransmitsCount
+   */
+  uint32_t GetRetransmitsBytes (void) const;
+
   /**
    * \brief Return total bytes in flight
    *
@@ -349,6 +671,7 @@ private:
   friend std::ostream & operator<< (std::ostream & os, TcpTxBuffer const & tcpTxBuf);
 
   typedef std::list<TcpTxItem*> PacketList; //!< container for data stored in the buffer
+  typedef std::map<SequenceNumber32, PacketList::iterator> SentIndex; //!< starting sequence of each item in the SentList
 
   /**
    * \brief Check if a segment is lost per RFC 6675
@@ -361,6 +684,199 @@ private:
   bool IsLost (const SequenceNumber32 &seq, const PacketList::const_iterator &segment, uint32_t dupThresh,
                uint32_t segmentSize) const;
 
+  /**
+   * \brief Move an item from the QED or SEND list at the end of the SentList
+   *
+   * The list node is spliced, so the move is constant-time and does not
+   * allocate. Update the index, the size of the SentList and the scoreboard.
+   * The per-message sizes (QED or SEND) are left to the caller.
+   *
+   * \param list the list which holds the item
+   * \param it the item to move
+   */
+  void AppendToSentList (PacketList &list, PacketList::iterator it);
+
+  /**
+   * \brief Encode the body held in m_encodeBuffer
+   * \param payloadSize bytes of payload in m_encodeBuffer
+   * \param redundancy bytes of redundancy after the payload
+   * \return the encoded body
+   */
+  Ptr<Packet> EncodeBody (uint32_t payloadSize, uint32_t redundancy);
+
+  /**
+   * \brief Build the body of a QED with a given redundancy length
+   * \param p the payload
+   * \param redundancy bytes of redundancy after the payload
+   * \return the encoded body
+   */
+  Ptr<Packet> Encode (Ptr<const Packet> p, uint32_t redundancy);
+
+  /**
+   * \brief Queue the QED and the SEND records of a packet, without framing
+   * them (LazyFraming)
+   * \param p the payload
+   * \return true if there was room for both records
+   */
+  bool AddLazy (Ptr<Packet> p);
+
+  /**
+   * \brief Get the buffer space taken by the records of a packet
+   * \param p the payload
+   * \return the size of its QED and SEND records
+   */
+  uint32_t GetRecordsSize (Ptr<const Packet> p) const;
+
+  /**
+   * \brief Queue the framed QED and SEND records of a packet, once there is
+   * room for them
+   * \param p the payload
+   */
+  void QueueMessage (Ptr<Packet> p);
+
+  /**
+   * \brief Queue the unframed QED and SEND records of a packet (LazyFraming),
+   * once there is room for them
+   * \param p the payload
+   */
+  void QueueLazy (Ptr<Packet> p);
+
+  /**
+   * \brief Frame and queue a QED record
+   * \param p the encoded body (payload and redundancy), framed in place
+   * \param atHead queue it before the QEDs not transmitted yet
+   */
+  void QueueQed (Ptr<Packet> p, bool atHead = false);
+
+  /**
+   * \brief Give back to the pool the pair taken by a SEND that returns to
+   * the unsent list, with the time at which it decoheres
+   * \param item the SEND item
+   */
+  void RefundPair (TcpTxItem *item);
+
+  /**
+   * \brief Remove pairs from QedAhead
+   *
+   * Asserts that they were counted: the counter is never clamped.
+   *
+   * \param pairs the number of pairs
+   */
+  void ReleaseQedAhead (uint32_t pairs);
+
+  /**
+   * \brief Get the identifier of the buffer in its entanglement pool
+   * \return the depositor identifier (registered on first use)
+   */
+  uint32_t GetDepositor (void);
+
+  /**
+   * \brief Frame and queue a SEND record
+   * \param p the payload
+   */
+  void QueueApp (Ptr<Packet> p);
+
+  /**
+   * \brief Build the record of an item added by AddLazy: header, payload
+   * and redundancy (encoded for a QED)
+   * \param item the item
+   */
+  void FrameItem (TcpTxItem *item);
+
+  /**
+   * \brief Frame the items at the head of a list that are not framed yet,
+   * until numBytes bytes are framed
+   * \param list the QED or the SEND list
+   * \param numBytes bytes about to be taken from the head of the list
+   */
+  void FrameItems (PacketList &list, uint32_t numBytes);
+
+  /**
+   * \brief Recompute the cached eligibility bits from the sizes of the lists
+   *
+   * Called by every method that changes m_size, m_appsentSize, m_stageSize
+   * or m_stagesentSize, or the pairs in the pool. Also updates the
+   * EntanglementBlocked trace source.
+   */
+  void UpdateEligibility (void);
+
+  /**
+   * \brief Get the expiry of an entanglement established now
+   * \return now plus the lifetime, or Time::Max () without decoherence
+   */
+  Time GetExpiry (void) const;
+
+  /**
+   * \brief Bytes that an item of the SentList adds to the pipe (RFC 6675 SetPipe)
+   * \param item the item
+   * \param begin starting sequence of the item
+   * \param lostBoundary lost boundary to use
+   * \return the number of bytes of the item that are in flight
+   */
+  uint32_t PipeContribution (const TcpTxItem *item, const SequenceNumber32 &begin,
+                             const SequenceNumber32 &lostBoundary) const;
+
+  /**
+   * \brief Compute the lost boundary per RFC 6675
+   *
+   * Walk the SACKed items backward from the highest SACK until dupThresh
+   * items or more than (dupThresh - 1) * segmentSize bytes are found: every
+   * un-SACKed item starting before the returned sequence is lost.
+   *
+   * \param dupThresh dupAck threshold
+   * \param segmentSize segment size
+   * \return the lost boundary (m_firstByteSeq if nothing is lost)
+   */
+  SequenceNumber32 LostBoundary (uint32_t dupThresh, uint32_t segmentSize) const;
+
+  /**
+   * \brief Move the lost boundary, updating the pipe of the items in between
+   * \param boundary the new lost boundary
+   */
+  void MoveLostBoundary (const SequenceNumber32 &boundary);
+
+  /**
+   * \brief Recompute the whole scoreboard from the SentList
+   *
+   * Used after operations that edit the SentList structure (split, merge or
+   * reset of the list).
+   */
+  void RecomputeScoreboard (void);
+
+  /**
+   * \brief Count an item of the SentList in the retransmit counters, if it
+   * is marked as retransmitted
+   * \param item the item
+   */
+  void AddRetransmit (const TcpTxItem *item);
+
+  /**
+   * \brief Remove an item of the SentList from the retransmit counters, if it
+   * is marked as retransmitted
+   * \param item the item
+   */
+  void RemoveRetransmit (const TcpTxItem *item);
+
+  /**
+   * \brief Move the block [seq, seq+numBytes) into the SentList, as the
+   * next transmission, and update the scoreboard
+   *
+   * The common part of CopyFromSequence and Reserve: the item is not stamped
+   * with the transmission time.
+   *
+   * \param numBytes number of bytes to take
+   * \param seq start sequence number
+   * \return the item of the block, or 0 if there is nothing to transmit
+   */
+  TcpTxItem* ReserveSegment (uint32_t numBytes, const SequenceNumber32& seq);
+
+  /**
+   * \brief Stamp an item with the transmission time
+   * \param item the item being transmitted
+   * \return a copy of its packet
+   */
+  Ptr<Packet> TransmitItem (TcpTxItem *item);
+
   /**
    * \brief Get a block of data not transmitted yet and move it into SentList
    *
@@ -456,16 +972,21 @@ private:
    * MSS can change, but it is stable, and retransmissions do not happen for
    * each segment).
    *
+   * When an index of the list is provided, the search for the item which
+   * contains requestedSeq starts from the index instead of the list head, and
+   * the index is kept in sync with the fragment and merge operations.
+   *
    * \param list List to extract block from
    * \param startingSeq Starting sequence of the list
    * \param numBytes Bytes to extract, starting from requestedSeq
    * \param requestedSeq Requested sequence
    * \param listEdited output parameter which indicates if the list has been edited
-   * \return the item that contains the right packet
+   * \param index index of the list (0 if the list is not indexed)
+   * \return iterator to the item that contains the right packet
    */
-  TcpTxItem* GetPacketFromList (PacketList &list, const SequenceNumber32 &startingSeq,
-                                uint32_t numBytes, const SequenceNumber32 &requestedSeq,
-                                bool *listEdited) const;
+  PacketList::iterator GetPacketFromList (PacketList &list, const SequenceNumber32 &startingSeq,
+                                          uint32_t numBytes, const SequenceNumber32 &requestedSeq,
+                                          bool *listEdited, SentIndex *index = 0);
 
   /**
    * \brief Merge two TcpTxItem
@@ -492,6 +1013,11 @@ private:
 
   /**
    * \brief Find the highest SACK byte
+   *
+   * The returned pair follows the same convention used in Update: the
+   * iterator points to the item after the highest SACKed one, and the
+   * sequence is the end of the highest SACKed item.
+   *
    * \return a pair with the highest byte and an iterator inside m_sentList
    */
   std::pair <TcpTxBuffer::PacketList::const_iterator, SequenceNumber32>
@@ -503,6 +1029,7 @@ private:
 
   PacketList m_appList;  //!< Buffer for application data
   PacketList m_sentList; //!< Buffer for sent (but not acked) data
+  SentIndex m_sentIndex; //!< Starting sequence of each item in m_sentList
 
   uint32_t m_maxBuffer;  //!< Max number of data bytes in buffer (SND.WND)
 
@@ -517,8 +1044,6 @@ private:
   uint32_t m_stage;//1--QED  0--SEND
  uint32_t m_sendQseq; //SEND message quantum sequence number.
 uint32_t m_stageQseq;//QED message quantum sequence number.
-uint32_t m_esQseq;// Unreliable entanglements number which QED consumed.
-int32_t m_qednum; //n_reli
 int32_t m_appnum; // Size of SEND message in the buffer.
 uint16_t m_qheader; //Quantum header length. 
 uint16_t m_red; //Redundancy bits size.
@@ -527,6 +1052,44 @@ uint16_t m_red; //Redundancy bits size.
 
   std::pair <PacketList::const_iterator, SequenceNumber32> m_highestSack; //!< Highest SACK byte
 
+  uint32_t m_sackedOut;    //!< Number of SACKed items in the SentList
+  uint32_t m_pipe;         //!< Bytes in flight (RFC 6675 pipe) for m_dupThresh and m_segmentSize
+  SequenceNumber32 m_lostBoundary; //!< Un-SACKed items starting before it are lost (RFC 6675)
+  uint32_t m_dupThresh;    //!< DupAck threshold used by the scoreboard
+  uint32_t m_segmentSize;  //!< Segment size used by the scoreboard
+
+  TracedValue<uint32_t> m_retransOut; //!< Number of retransmitted items in the SentList
+  uint32_t m_retransBytes; //!< Bytes of the retransmitted items in the SentList
+
+  TcpTxItemPool m_itemPool; //!< Allocator of the items of the three lists
+
+  TypeId m_encoderType;                //!< Type of the QED encoder
+  Ptr<QtcpEncoder> m_encoder;          //!< QED encoder
+  std::vector<uint8_t> m_encodeBuffer; //!< Scratch buffer of the body being encoded
+  bool m_lazyFraming;                  //!< Frame the records when they are transmitted
+
+  uint32_t m_qedLookahead;            //!< Maximum QEDs ahead of their SEND (0: no limit, QED first)
+  TracedValue<uint32_t> m_qedAhead;   //!< QEDs transmitted whose SEND is not transmitted yet
+
+  Ptr<EntanglementPool> m_pool;       //!< Entanglement pairs available to the SEND records
+  uint32_t m_depositor;               //!< Identifier of the buffer in m_pool
+  Time m_lifetime;                    //!< Lifetime of an entanglement (0: no decoherence)
+  uint32_t m_expiredPending;          //!< Lost pairs whose QED is not regenerated yet
+  QedLossPolicy m_qedLossPolicy;      //!< Recovery of the lost QED records
+
+  /**
+   * \brief Bits of m_eligibility
+   */
+  enum Eligibility
+  {
+    QED_UNSENT   = 1 << 0, //!< QED records wait for transmission
+    SEND_UNSENT  = 1 << 1, //!< SEND records wait for transmission
+    QED_DRAINED  = 1 << 2, //!< There are QED records, all transmitted
+    SEND_DRAINED = 1 << 3  //!< There are SEND records, all transmitted
+  };
+  uint8_t m_eligibility;                  //!< Eligibility bits, kept by UpdateEligibility
+  TracedValue<bool> m_entanglementBlocked; //!< IsBlockedOnEntanglement, kept by UpdateEligibility
+
 };
 
 /**